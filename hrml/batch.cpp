@@ -0,0 +1,166 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+
+namespace HRML {
+
+namespace {
+
+/* Most Hrml exceptions carry no message, their type says it all */
+std::string
+describe(const std::exception& e)
+{
+    if (*e.what() != '\0')
+        return e.what();
+    if (dynamic_cast<const HrmlNumericalDescription*>(&e))
+        return "bad line count header";
+    if (dynamic_cast<const HrmlNodeError*>(&e))
+        return "bad node line";
+    if (dynamic_cast<const HrmlQueryError*>(&e))
+        return "bad query line";
+    if (dynamic_cast<const HrmlParse*>(&e))
+        return "tags do not match";
+    if (dynamic_cast<const HrmlFail*>(&e))
+        return "input ended early";
+    if (dynamic_cast<const HrmlIncompleteRead*>(&e))
+        return "more lines than the header announces";
+    return "failed";
+}
+
+
+std::string
+document_name(std::size_t index)
+{
+    return "document " + std::to_string(index + 1);
+}
+
+}
+
+
+Batch::Batch(const Options& options, unsigned threads)
+    : options_{options}, pool_{threads}
+{
+    options_.parse_threads = 1;
+    options_.query_threads = 1;
+}
+
+
+template <class Load>
+void
+Batch::run(std::vector<BatchResult>& results, Load load)
+{
+    pool_.parallel_for(results.size(), 1,
+                       [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            try {
+                Hrml hrml{options_};
+                load(i, hrml);
+                std::ostringstream out;
+                out << hrml;
+                results[i].answers = out.str();
+                if (hrml.stats() != nullptr)
+                    results[i].stats = *hrml.stats();
+            } catch (const std::exception& e) {
+                results[i].error = describe(e);
+            }
+        }
+    });
+}
+
+
+std::vector<BatchResult>
+Batch::answer(const std::vector<std::string>& documents)
+{
+    std::vector<BatchResult> results(documents.size());
+    for (std::size_t i = 0; i < documents.size(); i++)
+        results[i].name = document_name(i);
+    run(results, [&](std::size_t i, Hrml& hrml) {
+        std::istringstream in{documents[i]};
+        in >> hrml;
+    });
+    return results;
+}
+
+
+std::vector<BatchResult>
+Batch::answer_files(const std::vector<std::string>& paths)
+{
+    std::vector<BatchResult> results(paths.size());
+    for (std::size_t i = 0; i < paths.size(); i++)
+        results[i].name = paths[i];
+    run(results, [&](std::size_t i, Hrml& hrml) {
+        hrml.load_file(paths[i]);
+    });
+    return results;
+}
+
+
+std::vector<BatchResult>
+Batch::answer_directory(const std::string& directory)
+{
+    std::vector<std::string> paths;
+    try {
+        for (const auto& entry :
+             std::filesystem::directory_iterator(directory))
+            if (entry.is_regular_file())
+                paths.push_back(entry.path().string());
+    } catch (const std::filesystem::filesystem_error& e) {
+        throw HrmlFail(e.what());
+    }
+    std::sort(paths.begin(), paths.end());
+    return answer_files(paths);
+}
+
+
+std::size_t
+Batch::answer_stream(std::istream& in,
+                     const std::function<void(const BatchResult&)>& done,
+                     std::size_t window)
+{
+    std::size_t count = 0;
+    std::string line;
+    bool more = true;
+
+    while (more) {
+        std::vector<std::string> documents;
+        std::string bad_header;
+        while (documents.size() < std::max<std::size_t>(1, window)) {
+            // A failed getline leaves line as it was, last line included
+            line.clear();
+            while (line.empty() && std::getline(in, line))
+                ;
+            if (line.empty()) {
+                more = false;
+                break;
+            }
+
+            std::istringstream header{line};
+            long long nodes, queries;
+            header >> nodes >> queries;
+            if (header.fail() || nodes < 0 || queries < 0) {
+                bad_header = "bad line count header \"" + line + "\"";
+                more = false;
+                break;
+            }
+
+            std::string text = line + "\n";
+            for (long long k = 0;
+                 k < nodes + queries && std::getline(in, line); k++)
+                text += line + "\n";
+            documents.push_back(std::move(text));
+        }
+
+        std::vector<BatchResult> results = answer(documents);
+        for (auto& result : results) {
+            result.name = document_name(count++);
+            done(result);
+        }
+        if (!bad_header.empty())
+            done({document_name(count++), "", bad_header});
+    }
+    return count;
+}
+
+}
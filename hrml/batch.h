@@ -0,0 +1,72 @@
+#ifndef BATCH_HPP_
+#define BATCH_HPP_
+
+#include "hrml.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace HRML {
+
+/* Outcome of one document of a batch */
+struct BatchResult {
+    /* File name, or "document N" (from 1) for a stream */
+    std::string name;
+    /* What operator<< prints, empty when the document failed */
+    std::string answers;
+    /* Why it failed, empty when it went through */
+    std::string error;
+    /* With Options::stats set, what reading and answering it took */
+    Stats stats;
+};
+
+
+/*
+ * Answers many independent documents, each in the format operator>>
+ * reads, one document per task across a thread pool. Every document gets
+ * its own Hrml with the given options, except that parse and query
+ * threads are forced to 1: the parallelism is across documents. Results
+ * come back in input order, and a document that fails only fails
+ * itself.
+ */
+class Batch {
+    public:
+        /* threads == 0 means one per hardware thread */
+        explicit Batch(const Options& options = Options(),
+                       unsigned threads = 0);
+
+        std::vector<BatchResult> answer(
+                const std::vector<std::string>& documents);
+        std::vector<BatchResult> answer_files(
+                const std::vector<std::string>& paths);
+        /* Regular files of directory, in name order */
+        std::vector<BatchResult> answer_directory(const std::string& directory);
+
+        /*
+         * Documents concatenated in a stream, each one ending after the
+         * node and query lines its header announces; blank lines between
+         * them are skipped. window documents are read and answered at a
+         * time, done() gets their results in order. A header that can not
+         * be read is reported as a failed document and ends the batch,
+         * since the next document can not be found. Returns the number
+         * of documents.
+         */
+        std::size_t answer_stream(
+                std::istream& in,
+                const std::function<void(const BatchResult&)>& done,
+                std::size_t window = 1024);
+
+    private:
+        template <class Load>
+        void run(std::vector<BatchResult>& results, Load load);
+
+        Options options_;
+        ThreadPool pool_;
+};
+
+}
+#endif
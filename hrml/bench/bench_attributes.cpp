@@ -0,0 +1,201 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "flat_map.h"
+#include "symbols.h"
+#include "tree.h"
+
+using namespace HRML;
+
+/*
+ * Attribute stores keyed by Symbol, state.range(0) attributes per node.
+ * Construction inserts every attribute of a node into a fresh store;
+ * lookup searches the keys and one miss in random order. TreeStore is
+ * what the document tree does: each build adds a node whose attributes
+ * go to a span of the tree's vectors, names interned on the way as when
+ * reading a document.
+ */
+class MapStore {
+    public:
+        void build(const std::vector<Symbol>& keys)
+        {
+            map_.clear();
+            for (Symbol key : keys)
+                map_[key] = "value";
+        }
+
+        const std::string* find(Symbol key) const
+        {
+            auto it = map_.find(key);
+            return it != map_.end() ? &it->second : nullptr;
+        }
+
+        bool full(void) const { return false; }
+        void reset(void) {}
+
+    private:
+        std::map<Symbol, std::string> map_;
+};
+
+
+class FlatStore {
+    public:
+        void build(const std::vector<Symbol>& keys)
+        {
+            map_.clear();
+            for (Symbol key : keys)
+                map_[key] = "value";
+        }
+
+        const std::string* find(Symbol key) const { return map_.find(key); }
+
+        bool full(void) const { return false; }
+        void reset(void) {}
+
+    private:
+        FlatMap<Symbol, std::string> map_;
+};
+
+
+class TreeStore {
+    public:
+        TreeStore(void) { reset(); }
+
+        void build(const std::vector<Symbol>& keys)
+        {
+            if (names_.empty()) {
+                // Names in key order, so symbols compare as the keys do
+                std::map<Symbol, std::string> sorted;
+                for (Symbol key : keys)
+                    sorted[key] = "a" + std::to_string(key);
+                for (const auto& entry : sorted)
+                    tree_->symbols().intern(entry.second);
+                for (Symbol key : keys)
+                    names_.push_back(sorted[key]);
+                for (const auto& name : names_)
+                    attributes_.push_back({name, "value", false, false});
+            }
+            node_ = tree_->add(no_node, 0, attributes_);
+        }
+
+        const std::string_view* find(Symbol key) const
+        {
+            return tree_->attribute(node_, key);
+        }
+
+        /* Symbols of the names build() used, in key order */
+        Symbol symbol(std::size_t rank) const
+        {
+            return static_cast<Symbol>(rank + 1);
+        }
+
+        bool full(void) const { return tree_->size() >= 1 << 12; }
+
+        void reset(void)
+        {
+            tree_ = std::make_unique<Tree>();
+            tree_->symbols().intern("t");
+            names_.clear();
+            attributes_.clear();
+        }
+
+    private:
+        std::unique_ptr<Tree> tree_;
+        NodeIndex node_ = no_node;
+        std::vector<std::string> names_;
+        std::vector<TokenAttribute> attributes_;
+};
+
+
+static std::vector<Symbol>
+keys(std::size_t n)
+{
+    // Not in insertion order, as symbols interned by earlier nodes
+    std::vector<Symbol> k;
+    for (std::size_t i = 0; i < n; i++)
+        k.push_back(static_cast<Symbol>((i * 7919) % 1000));
+    return k;
+}
+
+
+/* Keys the store was built with, as it looks them up */
+static std::vector<Symbol>
+lookup_keys(const MapStore&, const std::vector<Symbol>& k)
+{
+    return k;
+}
+
+
+static std::vector<Symbol>
+lookup_keys(const FlatStore&, const std::vector<Symbol>& k)
+{
+    return k;
+}
+
+
+static std::vector<Symbol>
+lookup_keys(const TreeStore& store, const std::vector<Symbol>& k)
+{
+    std::vector<Symbol> sorted{k}, symbols;
+    std::sort(sorted.begin(), sorted.end());
+    for (Symbol key : k)
+        symbols.push_back(store.symbol(static_cast<std::size_t>(
+                std::lower_bound(sorted.begin(), sorted.end(), key) -
+                sorted.begin())));
+    return symbols;
+}
+
+
+template <class Store>
+static void
+bm_attributes_build(benchmark::State& state)
+{
+    auto k = keys(static_cast<std::size_t>(state.range(0)));
+    Store store;
+    for (auto _ : state) {
+        if (store.full()) {
+            state.PauseTiming();
+            store.reset();
+            state.ResumeTiming();
+        }
+        store.build(k);
+        benchmark::DoNotOptimize(store);
+    }
+}
+
+
+template <class Store>
+static void
+bm_attributes_lookup(benchmark::State& state)
+{
+    auto k = keys(static_cast<std::size_t>(state.range(0)));
+    Store store;
+    store.build(k);
+    k = lookup_keys(store, k);
+    k.push_back(no_symbol - 1);
+
+    // In random order, a fixed one lets branch prediction learn the walk
+    std::mt19937 rng{3};
+    std::vector<Symbol> order(4096);
+    for (auto& key : order)
+        key = k[rng() % k.size()];
+
+    for (auto _ : state)
+        for (Symbol key : order)
+            benchmark::DoNotOptimize(store.find(key));
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(order.size()));
+}
+
+
+BENCHMARK_TEMPLATE(bm_attributes_build, MapStore)->DenseRange(1, 4)->Arg(16)->Arg(64);
+BENCHMARK_TEMPLATE(bm_attributes_build, FlatStore)->DenseRange(1, 4)->Arg(16)->Arg(64);
+BENCHMARK_TEMPLATE(bm_attributes_build, TreeStore)->DenseRange(1, 4)->Arg(16)->Arg(64);
+BENCHMARK_TEMPLATE(bm_attributes_lookup, MapStore)->DenseRange(1, 4)->Arg(16)->Arg(64);
+BENCHMARK_TEMPLATE(bm_attributes_lookup, FlatStore)->DenseRange(1, 4)->Arg(16)->Arg(64);
+BENCHMARK_TEMPLATE(bm_attributes_lookup, TreeStore)->DenseRange(1, 4)->Arg(16)->Arg(64);
@@ -0,0 +1,62 @@
+#include <benchmark/benchmark.h>
+#include <sstream>
+#include <string>
+
+#include "batch.h"
+
+using namespace HRML;
+
+/*
+ * Batch throughput: 2000 small documents (20 roots with chains of 4
+ * tags, 80 queries each) concatenated in one stream, answered by
+ * state.range(0) threads.
+ */
+static std::string
+documents(void)
+{
+    std::ostringstream stream;
+    for (unsigned n = 0; n < 2000; n++) {
+        std::ostringstream nodes, queries;
+        for (unsigned r = 0; r < 20; r++) {
+            std::string path = "r" + std::to_string(r);
+            nodes << "<r" << r << ">\n";
+            for (unsigned d = 0; d < 4; d++) {
+                nodes << "<t" << d << " v = \"" << n << "." << d << "\">\n";
+                path += ".t" + std::to_string(d);
+                queries << path << "~v\n";
+            }
+            for (unsigned d = 4; d-- > 0;)
+                nodes << "</t" << d << ">\n";
+            nodes << "</r" << r << ">\n";
+        }
+        stream << 20 * 10 << " " << 20 * 4 << "\n"
+               << nodes.str() << queries.str();
+    }
+    return stream.str();
+}
+
+
+static void
+bm_batch_stream(benchmark::State& state)
+{
+    static const std::string stream = documents();
+    Batch batch{Options(), static_cast<unsigned>(state.range(0))};
+
+    for (auto _ : state) {
+        std::istringstream in{stream};
+        std::size_t bytes = 0;
+        batch.answer_stream(in, [&](const BatchResult& result) {
+            bytes += result.answers.size();
+        });
+        benchmark::DoNotOptimize(bytes);
+    }
+    state.SetItemsProcessed(state.iterations() * 2000);
+}
+
+
+BENCHMARK(bm_batch_stream)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,265 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "hrml.h"
+#include "node.h"
+
+using namespace HRML;
+
+/*
+ * Core operations over generated documents: `fanout` roots, every node
+ * above `depth` levels holding `fanout` children, each node carrying
+ * `attributes` attributes. The children of a node are tagged t0, t1, ...
+ * so every tag path names one node. Queries are random paths, a quarter
+ * of them ending on a missing tag or attribute.
+ *
+ * Run with --benchmark_out=FILE --benchmark_out_format=json (or build
+ * the bench_json target) to keep the numbers for later comparison.
+ */
+struct Shape {
+    unsigned depth;
+    unsigned fanout;
+    unsigned attributes;
+    unsigned queries;
+};
+
+
+static void
+node_lines(const Shape& shape, unsigned level, unsigned& count,
+           const std::string& tag, std::vector<std::string>& lines)
+{
+    std::string open = "<" + tag;
+    for (unsigned a = 0; a < shape.attributes; a++)
+        open += " a" + std::to_string(a) + " = \"v" +
+                std::to_string(count) + "." + std::to_string(a) + "\"";
+    lines.push_back(open + ">");
+    count++;
+    if (level + 1 < shape.depth)
+        for (unsigned c = 0; c < shape.fanout; c++)
+            node_lines(shape, level + 1, count, "t" + std::to_string(c),
+                       lines);
+    lines.push_back("</" + tag + ">");
+}
+
+
+static std::vector<std::string>
+document_lines(const Shape& shape)
+{
+    std::vector<std::string> lines;
+    unsigned count = 0;
+    for (unsigned r = 0; r < shape.fanout; r++)
+        node_lines(shape, 0, count, "r" + std::to_string(r), lines);
+    return lines;
+}
+
+
+static std::vector<std::string>
+query_lines(const Shape& shape)
+{
+    std::mt19937 rng{42};
+    std::vector<std::string> queries;
+    for (unsigned q = 0; q < shape.queries; q++) {
+        std::string path = "r" + std::to_string(rng() % shape.fanout);
+        for (unsigned d = 1 + rng() % shape.depth; d > 1; d--)
+            path += ".t" + std::to_string(rng() % shape.fanout);
+        bool miss = rng() % 4 == 0;
+        if (miss && rng() % 2)
+            path += ".none";
+        unsigned attribute = shape.attributes == 0 || miss
+            ? shape.attributes : rng() % shape.attributes;
+        queries.push_back(path + "~a" + std::to_string(attribute));
+    }
+    return queries;
+}
+
+
+static std::string
+document(const Shape& shape)
+{
+    std::vector<std::string> lines = document_lines(shape);
+    std::vector<std::string> queries = query_lines(shape);
+    std::string text = std::to_string(lines.size()) + " " +
+                       std::to_string(queries.size()) + "\n";
+    for (const auto& line : lines)
+        text += line + "\n";
+    for (const auto& query : queries)
+        text += query + "\n";
+    return text;
+}
+
+
+static Shape
+shape(const benchmark::State& state)
+{
+    return {static_cast<unsigned>(state.range(0)),
+            static_cast<unsigned>(state.range(1)),
+            static_cast<unsigned>(state.range(2)),
+            static_cast<unsigned>(state.range(3))};
+}
+
+
+/* Discards everything written to it */
+class DropBuffer: public std::streambuf {
+    protected:
+        std::streamsize xsputn(const char*, std::streamsize n) override
+        {
+            return n;
+        }
+        int overflow(int c) override { return c; }
+};
+
+
+/* Node(const std::string&) over every node line of the document */
+static void
+bm_node_construction(benchmark::State& state)
+{
+    std::vector<std::string> lines = document_lines(shape(state));
+    for (auto _ : state)
+        for (const auto& line : lines) {
+            Node node{line};
+            benchmark::DoNotOptimize(node);
+        }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(lines.size()));
+}
+
+
+/* Reading a document without queries, which is init_nodes() */
+static void
+bm_init_nodes(benchmark::State& state)
+{
+    Shape s = shape(state);
+    s.queries = 0;
+    const std::string text = document(s);
+    for (auto _ : state) {
+        Hrml hrml;
+        std::istringstream in{text};
+        in >> hrml;
+        benchmark::DoNotOptimize(hrml.first_root());
+    }
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<int64_t>(text.size()));
+}
+
+
+static void
+bm_answer_query_mix(benchmark::State& state)
+{
+    Shape s = shape(state);
+    std::vector<std::string> texts = query_lines(s);
+    std::vector<std::string_view> queries(texts.begin(), texts.end());
+    s.queries = 0;
+    std::istringstream in{document(s)};
+    Hrml hrml;
+    in >> hrml;
+
+    for (auto _ : state) {
+        hrml.answer_queries(queries);
+        state.PauseTiming();
+        hrml.clear_answers();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(queries.size()));
+}
+
+
+/* root_node() by name for every root, then a missing one */
+static void
+bm_root_node(benchmark::State& state)
+{
+    Shape s = shape(state);
+    s.queries = 0;
+    std::istringstream in{document(s)};
+    Hrml hrml;
+    in >> hrml;
+
+    std::vector<std::string> names;
+    for (unsigned r = 0; r <= s.fanout; r++)
+        names.push_back("r" + std::to_string(r));
+    for (auto _ : state)
+        for (const auto& name : names)
+            benchmark::DoNotOptimize(hrml.root_node(name));
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(names.size()));
+}
+
+
+/* NodeRef::child() by name for every child of the first root */
+static void
+bm_child_lookup(benchmark::State& state)
+{
+    Shape s = shape(state);
+    s.queries = 0;
+    std::istringstream in{document(s)};
+    Hrml hrml;
+    in >> hrml;
+
+    NodeRef root = hrml.root_node("r0");
+    std::vector<std::string> names;
+    for (unsigned c = 0; c <= s.fanout; c++)
+        names.push_back("t" + std::to_string(c));
+    for (auto _ : state)
+        for (const auto& name : names)
+            benchmark::DoNotOptimize(root.child(name));
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(names.size()));
+}
+
+
+/* operator<< of the document's own answers */
+static void
+bm_print_answers(benchmark::State& state)
+{
+    std::istringstream in{document(shape(state))};
+    Hrml hrml;
+    in >> hrml;
+
+    DropBuffer drop;
+    std::ostream out{&drop};
+    for (auto _ : state)
+        out << hrml;
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(hrml.answers().size()));
+}
+
+
+static const std::vector<std::string> shape_names{"depth", "fanout",
+                                                  "attributes", "queries"};
+
+BENCHMARK(bm_node_construction)
+    ->ArgNames(shape_names)
+    ->Args({3, 8, 0, 0})
+    ->Args({3, 8, 4, 0})
+    ->Args({3, 8, 16, 0});
+BENCHMARK(bm_init_nodes)
+    ->ArgNames(shape_names)
+    ->Args({3, 8, 2, 0})
+    ->Args({5, 8, 2, 0})
+    ->Args({3, 32, 2, 0})
+    ->Args({3, 8, 16, 0})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(bm_answer_query_mix)
+    ->ArgNames(shape_names)
+    ->Args({3, 8, 2, 1000})
+    ->Args({6, 4, 2, 1000})
+    ->Args({3, 64, 2, 1000})
+    ->Args({3, 8, 2, 100000})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(bm_root_node)
+    ->ArgNames(shape_names)
+    ->Args({2, 8, 0, 0})
+    ->Args({2, 256, 0, 0});
+BENCHMARK(bm_child_lookup)
+    ->ArgNames(shape_names)
+    ->Args({2, 8, 0, 0})
+    ->Args({2, 256, 0, 0});
+BENCHMARK(bm_print_answers)
+    ->ArgNames(shape_names)
+    ->Args({3, 8, 2, 1000})
+    ->Args({3, 8, 2, 100000})
+    ->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,130 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "hrml.h"
+
+using namespace HRML;
+
+/*
+ * Editing against re-parsing: a document of state.range(0) roots, each
+ * holding a chain of 8 tags, then one edit (insert a subtree under a
+ * root, set an attribute, remove the subtree again) per iteration.
+ */
+static std::string
+chains(unsigned roots)
+{
+    std::ostringstream nodes;
+    for (unsigned r = 0; r < roots; r++) {
+        nodes << "<r" << r << ">\n";
+        for (unsigned d = 0; d < 8; d++)
+            nodes << "<t" << d << " v = \"" << r << "." << d << "\">\n";
+        for (unsigned d = 8; d-- > 0;)
+            nodes << "</t" << d << ">\n";
+        nodes << "</r" << r << ">\n";
+    }
+    return std::to_string(roots * 18) + " 0\n" + nodes.str();
+}
+
+
+static void
+bm_edit(benchmark::State& state)
+{
+    const std::string doc = chains(static_cast<unsigned>(state.range(0)));
+    Options options;
+    options.path_index = true;
+    Hrml hrml{options};
+    std::istringstream in{doc};
+    in >> hrml;
+
+    NodeRef root = hrml.root_node("r0");
+    for (auto _ : state) {
+        NodeRef added = hrml.insert(root, "<n v = \"1\">\n<m>\n</m>\n</n>");
+        hrml.set_attribute(added, "v", "2");
+        hrml.remove(added);
+    }
+}
+
+
+/* Same, with a pattern query after each edit, which needs the tag index */
+static void
+bm_edit_pattern(benchmark::State& state)
+{
+    const std::string doc = chains(static_cast<unsigned>(state.range(0)));
+    Options options;
+    options.path_index = true;
+    Hrml hrml{options};
+    std::istringstream in{doc};
+    in >> hrml;
+
+    NodeRef root = hrml.root_node("r0");
+    for (auto _ : state) {
+        NodeRef added = hrml.insert(root, "<n v = \"1\">\n<m>\n</m>\n</n>");
+        benchmark::DoNotOptimize(hrml.answer("r0..n~v"));
+        hrml.remove(added);
+        benchmark::DoNotOptimize(hrml.answer("r0..t7~v"));
+    }
+}
+
+
+/*
+ * Removing the first child with a tag from a wide parent walks on to the
+ * next child with that tag: state.range(0) others lie between each pair
+ * of x children, so every removal walks that far. Removed nodes keep
+ * their arena slots, so the document is read again, untimed, once its
+ * 64 x children are gone.
+ */
+static void
+bm_remove_first_of_tag(benchmark::State& state)
+{
+    const unsigned gap = static_cast<unsigned>(state.range(0));
+    const unsigned blocks = 64;
+    std::ostringstream nodes;
+    for (unsigned b = 0; b < blocks; b++) {
+        nodes << "<x v = \"" << b << "\">\n</x>\n";
+        for (unsigned i = 0; i < gap; i++)
+            nodes << "<c>\n</c>\n";
+    }
+    const std::string doc = std::to_string(2 * blocks * (gap + 1) + 2) +
+                            " 0\n<r>\n" + nodes.str() + "</r>\n";
+
+    std::unique_ptr<Hrml> hrml;
+    NodeRef root;
+    NodeRef first;
+    for (auto _ : state) {
+        if (!first) {
+            state.PauseTiming();
+            hrml = std::make_unique<Hrml>();
+            std::istringstream in{doc};
+            in >> *hrml;
+            root = hrml->root_node("r");
+            first = root.child("x");
+            state.ResumeTiming();
+        }
+        hrml->remove(first);
+        first = root.child("x");
+    }
+}
+
+
+static void
+bm_reparse(benchmark::State& state)
+{
+    const std::string doc = chains(static_cast<unsigned>(state.range(0)));
+    Options options;
+    options.path_index = true;
+
+    for (auto _ : state) {
+        Hrml hrml{options};
+        std::istringstream in{doc};
+        in >> hrml;
+        benchmark::DoNotOptimize(hrml.first_root());
+    }
+}
+
+
+BENCHMARK(bm_edit)->Arg(1000)->Arg(100000);
+BENCHMARK(bm_edit_pattern)->Arg(1000)->Arg(100000);
+BENCHMARK(bm_remove_first_of_tag)->Arg(8)->Arg(8192)->Iterations(512);
+BENCHMARK(bm_reparse)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
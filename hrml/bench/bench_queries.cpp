@@ -0,0 +1,346 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "document_handle.h"
+#include "hrml.h"
+
+using namespace HRML;
+
+/*
+ * Query answering scaling: 10M queries over a document of 1000 roots each
+ * holding a chain of 8 tags, answered by state.range(0) threads.
+ */
+static constexpr unsigned roots = 1000;
+static constexpr unsigned depth = 8;
+static constexpr std::size_t nqueries = 10000000;
+
+static std::string
+document(void)
+{
+    std::ostringstream nodes;
+    for (unsigned r = 0; r < roots; r++) {
+        nodes << "<r" << r << ">\n";
+        for (unsigned d = 0; d < depth; d++)
+            nodes << "<t" << d << " v = \"" << r << "." << d << "\">\n";
+        for (unsigned d = depth; d-- > 0;)
+            nodes << "</t" << d << ">\n";
+        nodes << "</r" << r << ">\n";
+    }
+    return std::to_string(roots * (depth + 1) * 2) + " 0\n" + nodes.str();
+}
+
+
+static std::vector<std::string>
+query_texts(void)
+{
+    std::vector<std::string> texts;
+    for (unsigned r = 0; r < roots; r++) {
+        std::string path = "r" + std::to_string(r);
+        for (unsigned d = 0; d < depth; d++) {
+            path += ".t" + std::to_string(d);
+            texts.push_back(path + "~v");
+        }
+    }
+    return texts;
+}
+
+
+static void
+bm_answer_queries(benchmark::State& state)
+{
+    static const std::string doc = document();
+    static const std::vector<std::string> texts = query_texts();
+
+    // Every query shape stays cached, this measures answering only
+    Options options;
+    options.query_threads = static_cast<unsigned>(state.range(0));
+    options.query_cache_size = texts.size();
+    Hrml hrml{options};
+    std::istringstream in{doc};
+    in >> hrml;
+
+    std::vector<std::string_view> queries;
+    queries.reserve(nqueries);
+    for (std::size_t i = 0; i < nqueries; i++)
+        queries.push_back(texts[(i * 7919) % texts.size()]);
+
+    for (auto _ : state) {
+        hrml.answer_queries(queries);
+        state.PauseTiming();
+        hrml.clear_answers();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(nqueries));
+}
+
+
+BENCHMARK(bm_answer_queries)
+    ->RangeMultiplier(2)
+    ->Range(1, std::max(1u, std::thread::hardware_concurrency()))
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+
+/*
+ * Path resolution by depth, with and without the path index: 1000 roots
+ * each holding a chain of state.range(0) tags with 8 leaf siblings in
+ * front of every chain link, queried once at the bottom of each chain.
+ */
+static std::string
+deep_document(unsigned chain)
+{
+    std::ostringstream nodes;
+    unsigned lines = 0;
+    for (unsigned r = 0; r < roots; r++) {
+        nodes << "<r" << r << ">\n";
+        for (unsigned d = 0; d < chain; d++) {
+            for (unsigned s = 0; s < 8; s++)
+                nodes << "<s" << s << ">\n</s" << s << ">\n";
+            nodes << "<t" << d << " v = \"" << r << "." << d << "\">\n";
+        }
+        for (unsigned d = chain; d-- > 0;)
+            nodes << "</t" << d << ">\n";
+        nodes << "</r" << r << ">\n";
+        lines += 2 + chain * 18;
+    }
+    std::ostringstream queries;
+    for (unsigned r = 0; r < roots; r++) {
+        queries << "r" << r;
+        for (unsigned d = 0; d < chain; d++)
+            queries << ".t" << d;
+        queries << "~v\n";
+    }
+    return std::to_string(lines) + " " + std::to_string(roots) + "\n" +
+           nodes.str() + queries.str();
+}
+
+
+static void
+bm_deep_paths(benchmark::State& state)
+{
+    const std::string doc = deep_document(
+            static_cast<unsigned>(state.range(0)));
+    Options options;
+    options.path_index = state.range(1) != 0;
+    Hrml hrml{options};
+    std::istringstream in{doc};
+    in >> hrml;
+
+    std::vector<std::string_view> queries;
+    std::string_view text{doc};
+    text.remove_prefix(doc.find("\nr0.") + 1);
+    while (!text.empty()) {
+        queries.push_back(text.substr(0, text.find('\n')));
+        text.remove_prefix(queries.back().size() + 1);
+    }
+
+    for (auto _ : state) {
+        hrml.answer_queries(queries);
+        state.PauseTiming();
+        hrml.clear_answers();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(queries.size()));
+    state.counters["index_bytes"] =
+        static_cast<double>(hrml.path_index_bytes());
+}
+
+
+BENCHMARK(bm_deep_paths)
+    ->ArgsProduct({{4, 16, 64}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+
+/*
+ * Load a document and answer a handful of queries, eager against lazy
+ * attributes: 1000 roots with chains of 20 tags, each node carrying 4
+ * attributes with 48 byte values, and 100 queries.
+ */
+static std::string
+attribute_heavy_document(void)
+{
+    const std::string value(48, 'x');
+    std::ostringstream nodes;
+    unsigned lines = 0;
+    for (unsigned r = 0; r < roots; r++) {
+        for (unsigned d = 0; d <= 20; d++) {
+            nodes << (d == 0 ? "<r" + std::to_string(r)
+                             : "<t" + std::to_string(d));
+            for (unsigned a = 0; a < 4; a++)
+                nodes << " a" << a << " = \"" << value << r << "\"";
+            nodes << ">\n";
+        }
+        for (unsigned d = 20; d > 0; d--)
+            nodes << "</t" << d << ">\n";
+        nodes << "</r" << r << ">\n";
+        lines += 42;
+    }
+    for (unsigned q = 0; q < 100; q++)
+        nodes << "r" << q * 7 << ".t1.t2~a" << q % 4 << "\n";
+    return std::to_string(lines) + " 100\n" + nodes.str();
+}
+
+
+static void
+bm_sparse_queries(benchmark::State& state)
+{
+    static const std::string doc = attribute_heavy_document();
+    Options options;
+    options.lazy_attributes = state.range(0) != 0;
+
+    for (auto _ : state) {
+        Hrml hrml{options};
+        std::istringstream in{doc};
+        in >> hrml;
+        benchmark::DoNotOptimize(hrml.answers().data());
+    }
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<int64_t>(doc.size()));
+}
+
+
+BENCHMARK(bm_sparse_queries)
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+
+/* Discards everything written to it */
+class NullBuffer: public std::streambuf {
+    protected:
+        std::streamsize xsputn(const char*, std::streamsize n) override
+        {
+            return n;
+        }
+        int overflow(int c) override { return c; }
+};
+
+
+/*
+ * Answering and printing 1M queries, half of them "Not Found!", into a
+ * stream that drops its input.
+ */
+static void
+bm_write_answers(benchmark::State& state)
+{
+    static const std::string doc = document();
+    static const std::vector<std::string> texts = query_texts();
+
+    Options options;
+    options.query_cache_size = texts.size() * 2;
+    Hrml hrml{options};
+    std::istringstream in{doc};
+    in >> hrml;
+
+    std::vector<std::string> missing;
+    for (const auto& text : texts)
+        missing.push_back(text + "x");
+    std::vector<std::string_view> queries;
+    for (std::size_t i = 0; i < 1000000; i++) {
+        const auto& pool = i % 2 ? missing : texts;
+        queries.push_back(pool[(i * 7919) % pool.size()]);
+    }
+
+    NullBuffer null;
+    std::ostream out{&null};
+    for (auto _ : state) {
+        hrml.answer_queries(queries);
+        out << hrml;
+        state.PauseTiming();
+        hrml.clear_answers();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(queries.size()));
+}
+
+
+BENCHMARK(bm_write_answers)->Unit(benchmark::kMillisecond);
+
+
+/*
+ * Pin the current document and answer one query, while a writer thread
+ * keeps publishing freshly parsed copies (state.range(0) == 1) or not.
+ */
+static void
+bm_pinned_answer(benchmark::State& state)
+{
+    static const std::string doc = document();
+    static const std::vector<std::string> texts = query_texts();
+
+    auto parse = []() {
+        auto hrml = std::make_unique<Hrml>();
+        std::istringstream in{doc};
+        in >> *hrml;
+        return hrml;
+    };
+    DocumentHandle handle{parse()};
+
+    std::atomic<bool> done{false};
+    std::thread writer;
+    if (state.range(0) != 0) {
+        writer = std::thread([&]() {
+            while (!done.load())
+                handle.publish(parse());
+        });
+    }
+
+    std::size_t i = 0;
+    for (auto _ : state) {
+        auto snapshot = handle.pin();
+        benchmark::DoNotOptimize(
+                snapshot->answer(texts[i++ % texts.size()]).data());
+    }
+    done.store(true);
+    if (writer.joinable())
+        writer.join();
+}
+
+
+BENCHMARK(bm_pinned_answer)->Arg(0)->Arg(1)->UseRealTime();
+
+
+/*
+ * Pattern queries over the chain document: 100k queries, descendant steps
+ * below a root (r..t), below any root (*..t) and wildcards (r.*.*), mixed.
+ */
+static void
+bm_pattern_queries(benchmark::State& state)
+{
+    static const std::string doc = document();
+    Hrml hrml;
+    std::istringstream in{doc};
+    in >> hrml;
+
+    std::vector<std::string> texts;
+    for (unsigned r = 0; r < roots; r += 10) {
+        std::string root = "r" + std::to_string(r);
+        for (unsigned d = 0; d < depth; d++) {
+            std::string tag = "t" + std::to_string(d);
+            texts.push_back(root + ".." + tag + "~v");
+            texts.push_back("*.." + tag + "~v");
+        }
+        texts.push_back(root + ".*.*~v");
+    }
+    std::vector<std::string_view> queries;
+    for (std::size_t i = 0; i < 100000; i++)
+        queries.push_back(texts[(i * 7919) % texts.size()]);
+
+    for (auto _ : state) {
+        hrml.answer_queries(queries);
+        state.PauseTiming();
+        hrml.clear_answers();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>(queries.size()));
+}
+
+
+BENCHMARK(bm_pattern_queries)->Unit(benchmark::kMillisecond);
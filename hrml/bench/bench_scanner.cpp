@@ -0,0 +1,48 @@
+#include <benchmark/benchmark.h>
+#include <string>
+
+#include "scanner.h"
+
+using namespace HRML;
+
+/*
+ * Delimiter scanning over a quoted payload of state.range(0) bytes with
+ * the closing quote at the very end, the common case for long values.
+ */
+static std::string
+payload(std::size_t n)
+{
+    std::string s;
+    s.reserve(n + 1);
+    for (std::size_t i = 0; i < n; i++)
+        s += static_cast<char>('a' + i % 26);
+    s += '"';
+    return s;
+}
+
+
+static void
+bm_scan(benchmark::State& state, ScanKernel kernel)
+{
+    if (!scan_kernel_supported(kernel)) {
+        state.SkipWithError("kernel not supported on this cpu");
+        return;
+    }
+    std::string s = payload(static_cast<std::size_t>(state.range(0)));
+    const char* last = s.data() + s.size();
+    for (auto _ : state) {
+        const char* p = find_delimiter(kernel, s.data(), last,
+                                       structural_delimiters);
+        benchmark::DoNotOptimize(p);
+    }
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<int64_t>(s.size()));
+}
+
+
+BENCHMARK_CAPTURE(bm_scan, scalar, ScanKernel::scalar)
+    ->RangeMultiplier(4)->Range(16, 16 << 10);
+BENCHMARK_CAPTURE(bm_scan, sse2, ScanKernel::sse2)
+    ->RangeMultiplier(4)->Range(16, 16 << 10);
+BENCHMARK_CAPTURE(bm_scan, avx2, ScanKernel::avx2)
+    ->RangeMultiplier(4)->Range(16, 16 << 10);
@@ -0,0 +1,84 @@
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "hrml.h"
+
+using namespace HRML;
+
+/*
+ * Start up cost: loading a text document against opening its snapshot.
+ * The document has state.range(0) roots, each holding a chain of 20
+ * tags with 4 attributes of 48 byte values, and one query is answered
+ * so the snapshot copies some values out.
+ */
+static std::string
+document(unsigned roots)
+{
+    const std::string value(48, 'x');
+    std::ostringstream nodes;
+    for (unsigned r = 0; r < roots; r++) {
+        for (unsigned d = 0; d <= 20; d++) {
+            nodes << (d == 0 ? "<r" + std::to_string(r)
+                             : "<t" + std::to_string(d));
+            for (unsigned a = 0; a < 4; a++)
+                nodes << " a" << a << " = \"" << value << r % 100 << "\"";
+            nodes << ">\n";
+        }
+        for (unsigned d = 20; d > 0; d--)
+            nodes << "</t" << d << ">\n";
+        nodes << "</r" << r << ">\n";
+    }
+    return std::to_string(roots * 42) + " 0\n" + nodes.str();
+}
+
+
+static const std::string text_path = "/tmp/hrml_bench_document";
+static const std::string snapshot_path = "/tmp/hrml_bench_snapshot";
+
+
+static void
+write_files(unsigned roots)
+{
+    std::ofstream{text_path} << document(roots);
+    Hrml hrml;
+    hrml.load_file(text_path);
+    hrml.save_snapshot(snapshot_path);
+}
+
+
+static void
+bm_load_text(benchmark::State& state)
+{
+    write_files(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+        Hrml hrml;
+        hrml.load_file(text_path);
+        benchmark::DoNotOptimize(hrml.answer("r7.t1.t2~a3").data());
+    }
+    std::remove(text_path.c_str());
+    std::remove(snapshot_path.c_str());
+}
+
+
+static void
+bm_open_snapshot(benchmark::State& state)
+{
+    write_files(static_cast<unsigned>(state.range(0)));
+    for (auto _ : state) {
+        Hrml hrml;
+        hrml.open_snapshot(snapshot_path);
+        benchmark::DoNotOptimize(hrml.answer("r7.t1.t2~a3").data());
+    }
+    std::remove(text_path.c_str());
+    std::remove(snapshot_path.c_str());
+}
+
+
+BENCHMARK(bm_load_text)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_open_snapshot)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
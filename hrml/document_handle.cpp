@@ -0,0 +1,118 @@
+#include "document_handle.h"
+
+#include <functional>
+#include <thread>
+
+namespace HRML {
+
+DocumentHandle::Snapshot&
+DocumentHandle::Snapshot::operator=(Snapshot&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        slot_ = std::exchange(other.slot_, nullptr);
+        version_ = other.version_;
+    }
+    return *this;
+}
+
+
+void
+DocumentHandle::Snapshot::release(void)
+{
+    if (slot_ != nullptr)
+        slot_->epoch.store(idle, std::memory_order_release);
+    slot_ = nullptr;
+}
+
+
+DocumentHandle::DocumentHandle(std::unique_ptr<const Hrml> document,
+                               std::size_t reader_slots)
+    : slots_{new Slot[std::max<std::size_t>(1, reader_slots)]},
+      reader_slots_{std::max<std::size_t>(1, reader_slots)},
+      epoch_{0}, current_{nullptr}, versions_{0}
+{
+    for (std::size_t i = 0; i < reader_slots_; i++)
+        slots_[i].epoch.store(idle, std::memory_order_relaxed);
+    if (document)
+        publish(std::move(document));
+}
+
+
+DocumentHandle::~DocumentHandle(void)
+{
+    // No snapshot may outlive the handle
+    for (auto& retired : retired_)
+        delete retired.first;
+    delete current_.load();
+}
+
+
+DocumentHandle::Snapshot
+DocumentHandle::pin(void) const
+{
+    // Threads start looking at different slots to avoid fighting over one
+    static thread_local std::size_t hint =
+        std::hash<std::thread::id>{}(std::this_thread::get_id());
+
+    for (std::size_t attempt = 0;; attempt++) {
+        std::size_t i = (hint + attempt) % reader_slots_;
+        std::uint64_t expected = idle;
+        std::uint64_t epoch = epoch_.load();
+        if (slots_[i].epoch.compare_exchange_strong(expected, epoch)) {
+            hint = i;
+            return Snapshot(&slots_[i], current_.load());
+        }
+        if (attempt % reader_slots_ == reader_slots_ - 1)
+            std::this_thread::yield();
+    }
+}
+
+
+std::uint64_t
+DocumentHandle::publish(std::unique_ptr<const Hrml> document)
+{
+    std::lock_guard<std::mutex> lock{writer_mutex_};
+
+    auto* version = new Version{std::move(document), ++versions_};
+    Version* old = current_.exchange(version);
+    // Readers that may have loaded old all hold an earlier epoch
+    std::uint64_t retire_epoch = epoch_.fetch_add(1) + 1;
+    if (old != nullptr)
+        retired_.emplace_back(old, retire_epoch);
+
+    reclaim_locked();
+    return version->number;
+}
+
+
+std::size_t
+DocumentHandle::reclaim(void)
+{
+    std::lock_guard<std::mutex> lock{writer_mutex_};
+    return reclaim_locked();
+}
+
+
+std::size_t
+DocumentHandle::reclaim_locked(void)
+{
+    if (retired_.empty())
+        return 0;
+
+    std::uint64_t oldest = idle;
+    for (std::size_t i = 0; i < reader_slots_; i++)
+        oldest = std::min(oldest, slots_[i].epoch.load());
+
+    std::size_t kept = 0;
+    for (auto& retired : retired_) {
+        if (retired.second <= oldest)
+            delete retired.first;
+        else
+            retired_[kept++] = retired;
+    }
+    retired_.resize(kept);
+    return kept;
+}
+
+}
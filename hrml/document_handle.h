@@ -0,0 +1,118 @@
+#ifndef DOCUMENT_HANDLE_HPP_
+#define DOCUMENT_HANDLE_HPP_
+
+#include "hrml.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace HRML {
+
+/*
+ * Current version of a document, replaced while readers keep querying.
+ *
+ * Readers pin() a snapshot without taking a lock. They claim a reader
+ * slot, store the global epoch in it, then load the current version. A
+ * writer builds the replacement off to the side and publish()es it with
+ * one atomic exchange. The old version is retired with the epoch that
+ * follows the exchange, and it is freed once no slot holds an earlier
+ * epoch. A reader that is still on an old version can never block a
+ * reader of the new one.
+ *
+ * Snapshots only give const access. Query them through
+ * Hrml::answer(), which does not touch the plan cache.
+ */
+class DocumentHandle {
+    private:
+        struct Version {
+            std::unique_ptr<const Hrml> document;
+            std::uint64_t number;
+        };
+
+        struct alignas(64) Slot {
+            std::atomic<std::uint64_t> epoch;
+        };
+
+    public:
+        static constexpr std::size_t default_reader_slots = 128;
+
+        class Snapshot {
+            public:
+                Snapshot(Snapshot&& other) noexcept
+                    : slot_{std::exchange(other.slot_, nullptr)},
+                      version_{other.version_} {}
+                ~Snapshot(void) { release(); }
+
+                Snapshot(const Snapshot&) = delete;
+                Snapshot& operator=(const Snapshot&) = delete;
+                Snapshot& operator=(Snapshot&& other) noexcept;
+
+                /* nullptr before the first publish() */
+                const Hrml* get(void) const
+                {
+                    return version_ ? version_->document.get() : nullptr;
+                }
+                const Hrml& operator*(void) const { return *get(); }
+                const Hrml* operator->(void) const { return get(); }
+                /* Number publish() returned for it, 0 when empty */
+                std::uint64_t version(void) const
+                {
+                    return version_ ? version_->number : 0;
+                }
+
+            private:
+                friend class DocumentHandle;
+                Snapshot(Slot* slot, const Version* version)
+                    : slot_{slot}, version_{version} {}
+                void release(void);
+
+                Slot* slot_;
+                const Version* version_;
+        };
+
+        explicit DocumentHandle(
+                std::unique_ptr<const Hrml> document = nullptr,
+                std::size_t reader_slots = default_reader_slots);
+        ~DocumentHandle(void);
+
+        DocumentHandle(const DocumentHandle&) = delete;
+        DocumentHandle& operator=(const DocumentHandle&) = delete;
+
+        /*
+         * Lock free while fewer than reader_slots snapshots are pinned,
+         * otherwise waits for one to go.
+         */
+        Snapshot pin(void) const;
+
+        /*
+         * Make document the current version and return its number.
+         * Retired versions no reader can still see are freed.
+         */
+        std::uint64_t publish(std::unique_ptr<const Hrml> document);
+
+        /* Free what can be freed, return how many versions wait */
+        std::size_t reclaim(void);
+
+    private:
+        static constexpr std::uint64_t idle = UINT64_MAX;
+
+        std::size_t reclaim_locked(void);
+
+        std::unique_ptr<Slot[]> slots_;
+        std::size_t reader_slots_;
+        std::atomic<std::uint64_t> epoch_;
+        std::atomic<Version*> current_;
+
+        /* Writers only */
+        std::mutex writer_mutex_;
+        std::uint64_t versions_;
+        std::vector<std::pair<Version*, std::uint64_t>> retired_;
+};
+
+}
+#endif
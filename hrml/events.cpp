@@ -0,0 +1,94 @@
+#include "events.h"
+#include "hrml.h"
+
+#include <sstream>
+
+namespace HRML {
+
+EventParser::EventParser(EventHandler& handler, SymbolTable* symbols)
+    : handler_{handler}, symbols_{symbols}, depth_{0}, symbol_{no_symbol}
+{
+
+}
+
+
+bool
+EventParser::matches_open(std::string_view tag)
+{
+    if (depth_ == 0)
+        return false;
+    if (symbols_ == nullptr)
+        return open_[depth_ - 1] == tag;
+
+    // A tag missing from the table can not match any open one
+    symbol_ = symbols_->find(tag);
+    return symbol_ != no_symbol && open_symbols_[depth_ - 1] == symbol_;
+}
+
+
+void
+EventParser::push_open(std::string_view tag)
+{
+    if (symbols_ != nullptr) {
+        symbol_ = symbols_->intern(tag);
+        open_symbols_.resize(depth_);
+        open_symbols_.push_back(symbol_);
+    } else if (depth_ == open_.size()) {
+        // Popped entries are kept around to reuse their buffers
+        open_.emplace_back(tag);
+    } else {
+        open_[depth_].assign(tag);
+    }
+    ++depth_;
+}
+
+
+void
+EventParser::feed(std::string_view line)
+{
+    tokenize(line, token_);
+    feed(token_);
+}
+
+
+void
+EventParser::feed(const Token& token)
+{
+    if (!token.is_valid)
+        throw HrmlParse("Non-valid node: " + std::string(token.tag));
+
+    if (token.is_closing) {
+        if (!matches_open(token.tag))
+            throw HrmlParse("Error parsing - bad tag: " +
+                            std::string(token.tag));
+        --depth_;
+        handler_.on_close(token.tag);
+    } else {
+        push_open(token.tag);
+        handler_.on_open(token.tag, token.attributes);
+    }
+}
+
+
+void
+EventParser::parse(std::istream& in)
+{
+    std::string s;
+    unsigned nsrcs = 0;
+    unsigned nqueries = 0;
+
+    std::getline(in, s);
+    std::istringstream iss{s};
+    iss >> nsrcs >> nqueries;
+    if (iss.fail())
+        throw HrmlNumericalDescription();
+
+    for (unsigned i = 0; i < nsrcs && !in.fail(); i++) {
+        std::getline(in, s);
+        if (!has_brackets(s))
+            throw HrmlNodeError();
+        feed(s);
+    }
+}
+
+}
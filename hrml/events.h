@@ -0,0 +1,73 @@
+#ifndef EVENTS_HPP_
+#define EVENTS_HPP_
+
+#include "symbols.h"
+#include "tokenizer.h"
+
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace HRML {
+
+/*
+ * Receiver of push-style parse events. Views passed to the handler are
+ * only valid for the duration of the call; see TokenAttribute for how to
+ * get the stored text of an attribute.
+ */
+class EventHandler {
+    public:
+        virtual ~EventHandler(void) = default;
+
+        virtual void on_open(std::string_view tag,
+                             const std::vector<TokenAttribute>& attributes) = 0;
+        virtual void on_close(std::string_view tag) = 0;
+};
+
+
+/*
+ * Tokenizes hrml node lines and pushes them to a handler, checking that
+ * every closing tag matches the innermost open one. Only the stack of
+ * open tags is kept, so memory is bounded by the nesting depth.
+ * Errors are reported with the same HrmlParse messages as Hrml.
+ *
+ * Given a SymbolTable, open tags are interned and closing tags matched by
+ * symbol; symbol() then gives the id of the tag being reported, so a
+ * handler sharing the table does not have to look it up again.
+ */
+class EventParser {
+    public:
+        explicit EventParser(EventHandler& handler,
+                             SymbolTable* symbols = nullptr);
+
+        void feed(std::string_view line);
+        void feed(const Token& token);
+
+        /*
+         * Read an hrml document header and its node lines from in, one
+         * line at a time, leaving the query lines unread. Lines are
+         * validated as they arrive, so a bad line is reported even if an
+         * earlier one would fail to parse.
+         */
+        void parse(std::istream& in);
+
+        std::size_t depth(void) const { return depth_; }
+        Symbol symbol(void) const { return symbol_; }
+
+    private:
+        bool matches_open(std::string_view tag);
+        void push_open(std::string_view tag);
+
+        EventHandler& handler_;
+        SymbolTable* symbols_;
+        Token token_;
+        std::vector<std::string> open_;
+        std::vector<Symbol> open_symbols_;
+        std::size_t depth_;
+        Symbol symbol_;
+};
+
+}
+#endif
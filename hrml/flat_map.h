@@ -0,0 +1,209 @@
+#ifndef FLAT_MAP_HPP_
+#define FLAT_MAP_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace HRML {
+
+/*
+ * Small associative container for attributes. The first N entries live
+ * inside the object, more spill to one heap block. Every inline entry
+ * adds a whole pair to the object, used or not; the default of 4 covers
+ * almost every node without allocating. Up to
+ * sorted_threshold entries are kept in insertion order and searched
+ * linearly; past that the entries are sorted by key and searched by
+ * bisection. Assigning an existing key overwrites its value, like
+ * std::map::operator[].
+ */
+template <class Key, class Value, std::size_t N = 4>
+class FlatMap {
+    public:
+        using value_type = std::pair<Key, Value>;
+        using const_iterator = const value_type*;
+        static constexpr std::size_t sorted_threshold = 16;
+
+        FlatMap(void) : data_{inline_data()}, size_{0}, capacity_{N} {}
+
+        FlatMap(const FlatMap& other) : FlatMap()
+        {
+            reserve(other.size_);
+            for (const auto& entry : other)
+                new (data_ + size_++) value_type(entry);
+        }
+
+        FlatMap(FlatMap&& other) noexcept : FlatMap()
+        {
+            steal(other);
+        }
+
+        FlatMap& operator=(const FlatMap& other)
+        {
+            if (this != &other) {
+                FlatMap copy{other};
+                clear();
+                steal(copy);
+            }
+            return *this;
+        }
+
+        FlatMap& operator=(FlatMap&& other) noexcept
+        {
+            if (this != &other) {
+                clear();
+                steal(other);
+            }
+            return *this;
+        }
+
+        ~FlatMap(void) { clear(); }
+
+        std::size_t size(void) const { return size_; }
+        bool empty(void) const { return size_ == 0; }
+        const_iterator begin(void) const { return data_; }
+        const_iterator end(void) const { return data_ + size_; }
+
+        /* nullptr when key is not there */
+        template <class K>
+        const Value* find(const K& key) const
+        {
+            if (!sorted()) {
+                for (const value_type* it = begin(); it != end(); ++it)
+                    if (it->first == key) return &it->second;
+                return nullptr;
+            }
+            const value_type* it = locate(key);
+            return it != end() && it->first == key ? &it->second : nullptr;
+        }
+
+        Value& operator[](const Key& key)
+        {
+            value_type* it = const_cast<value_type*>(locate(key));
+            if (it != end() && it->first == key)
+                return it->second;
+            return insert(it, key);
+        }
+
+        /* false when key is not there */
+        bool erase(const Key& key)
+        {
+            value_type* it = const_cast<value_type*>(locate(key));
+            if (it == end() || !(it->first == key))
+                return false;
+            // Shifting keeps the sorted layout sorted
+            std::move(it + 1, data_ + size_, it);
+            data_[--size_].~value_type();
+            return true;
+        }
+
+        void clear(void)
+        {
+            for (std::size_t i = 0; i < size_; i++)
+                data_[i].~value_type();
+            if (data_ != inline_data())
+                ::operator delete(data_);
+            data_ = inline_data();
+            size_ = 0;
+            capacity_ = N;
+        }
+
+    private:
+        value_type* inline_data(void)
+        {
+            return reinterpret_cast<value_type*>(inline_);
+        }
+
+        bool sorted(void) const { return size_ > sorted_threshold; }
+
+        /*
+         * Entry holding key, or where it has to go: end() for the linear
+         * layout, the lower bound for the sorted one.
+         */
+        template <class K>
+        const value_type* locate(const K& key) const
+        {
+            if (!sorted())
+                return std::find_if(begin(), end(), [&](const auto& e) {
+                    return e.first == key;
+                });
+            // Branch-free bisection, the compare only picks the half
+            const value_type* base = begin();
+            std::size_t n = size_;
+            while (n > 1) {
+                std::size_t half = n / 2;
+                base = base[half].first < key ? base + half : base;
+                n -= half;
+            }
+            return base + (base->first < key);
+        }
+
+        Value& insert(value_type* pos, const Key& key)
+        {
+            std::size_t at = pos - data_;
+            reserve(size_ + 1);
+
+            if (size_ == sorted_threshold) {
+                // Switching to the sorted layout
+                std::sort(data_, data_ + size_, [](const auto& a,
+                                                   const auto& b) {
+                    return a.first < b.first;
+                });
+                at = std::lower_bound(data_, data_ + size_, key,
+                                      [](const auto& e, const Key& k) {
+                    return e.first < k;
+                }) - data_;
+            }
+
+            new (data_ + size_) value_type(key, Value());
+            std::rotate(data_ + at, data_ + size_, data_ + size_ + 1);
+            ++size_;
+            return data_[at].second;
+        }
+
+        void reserve(std::size_t n)
+        {
+            if (n <= capacity_)
+                return;
+            std::size_t capacity = std::max<std::size_t>(n, capacity_ * 2);
+            auto* data = static_cast<value_type*>(
+                    ::operator new(capacity * sizeof(value_type)));
+            for (std::size_t i = 0; i < size_; i++) {
+                new (data + i) value_type(std::move(data_[i]));
+                data_[i].~value_type();
+            }
+            if (data_ != inline_data())
+                ::operator delete(data_);
+            data_ = data;
+            capacity_ = static_cast<std::uint32_t>(capacity);
+        }
+
+        /* Take other's entries, this must be empty */
+        void steal(FlatMap& other)
+        {
+            if (other.data_ != other.inline_data()) {
+                data_ = other.data_;
+                size_ = other.size_;
+                capacity_ = other.capacity_;
+                other.data_ = other.inline_data();
+                other.size_ = 0;
+                other.capacity_ = N;
+                return;
+            }
+            for (std::size_t i = 0; i < other.size_; i++)
+                new (data_ + i) value_type(std::move(other.data_[i]));
+            size_ = other.size_;
+            other.clear();
+        }
+
+        value_type* data_;
+        std::uint32_t size_;
+        std::uint32_t capacity_;
+        alignas(value_type) unsigned char inline_[N * sizeof(value_type)];
+};
+
+}
+#endif
@@ -0,0 +1,327 @@
+#include "generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace HRML {
+
+namespace {
+
+/*
+ * splitmix64, small and fully specified: the same seed gives the same
+ * document with any standard library.
+ */
+class Random {
+    public:
+        explicit Random(std::uint64_t seed) : state_{seed} {}
+
+        std::uint64_t next(void)
+        {
+            std::uint64_t z = (state_ += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        }
+
+        /* [0, n), n > 0 */
+        std::uint64_t below(std::uint64_t n) { return next() % n; }
+        /* [lo, hi] */
+        std::uint64_t between(std::uint64_t lo, std::uint64_t hi)
+        {
+            return lo + below(hi - lo + 1);
+        }
+        /* [0, 1) */
+        double real(void) { return (next() >> 11) * 0x1.0p-53; }
+
+    private:
+        std::uint64_t state_;
+};
+
+
+/* Collects output and writes it in large blocks */
+class BlockWriter {
+    public:
+        explicit BlockWriter(std::ostream& out) : out_{out}
+        {
+            buffer_.reserve(block);
+        }
+
+        BlockWriter& operator<<(std::string_view s)
+        {
+            if (buffer_.size() + s.size() > block)
+                flush();
+            buffer_.append(s);
+            return *this;
+        }
+
+        BlockWriter& operator<<(std::uint64_t n)
+        {
+            return *this << std::string_view(std::to_string(n));
+        }
+
+        void flush(void)
+        {
+            out_.write(buffer_.data(),
+                       static_cast<std::streamsize>(buffer_.size()));
+            buffer_.clear();
+            if (!out_)
+                throw std::runtime_error("generator output failed");
+        }
+
+    private:
+        static constexpr std::size_t block = 1 << 16;
+
+        std::ostream& out_;
+        std::string buffer_;
+};
+
+
+/* Uniform sample of hit queries for each path depth (reservoirs) */
+class HitSampler {
+    public:
+        HitSampler(unsigned depth, std::size_t capacity)
+            : samples_(depth + 1), seen_(depth + 1, 0), capacity_{capacity} {}
+
+        void add(unsigned depth, std::string query, Random& random)
+        {
+            std::uint64_t n = seen_[depth]++;
+            if (samples_[depth].size() < capacity_)
+                samples_[depth].push_back(std::move(query));
+            else if (std::uint64_t i = random.below(n + 1); i < capacity_)
+                samples_[depth][i] = std::move(query);
+        }
+
+        /* A hit at most depth levels deep, nullptr when there is none */
+        const std::string* pick(unsigned depth, Random& random) const
+        {
+            for (unsigned d = depth; d > 0; d--)
+                if (!samples_[d].empty())
+                    return &samples_[d][random.below(samples_[d].size())];
+            for (unsigned d = depth + 1; d < samples_.size(); d++)
+                if (!samples_[d].empty())
+                    return &samples_[d][random.below(samples_[d].size())];
+            return nullptr;
+        }
+
+    private:
+        std::vector<std::vector<std::string>> samples_;
+        std::vector<std::uint64_t> seen_;
+        std::size_t capacity_;
+};
+
+
+void
+check(const GeneratorOptions& options)
+{
+    if (options.depth == 0 || options.tags == 0)
+        throw std::invalid_argument("depth and tags must be positive");
+    if (options.min_attributes > options.max_attributes ||
+        options.min_value_length > options.max_value_length)
+        throw std::invalid_argument("range with min above max");
+    if (options.min_attributes > options.names)
+        throw std::invalid_argument("more attributes than names");
+    if (options.min_value_length == 0 && options.max_attributes > 0)
+        throw std::invalid_argument("attribute values can not be empty");
+    if (!(options.fanout >= 0) || !(options.skew >= 0) ||
+        !(options.hit_ratio >= 0 && options.hit_ratio <= 1))
+        throw std::invalid_argument("fanout, skew or hit ratio out of range");
+}
+
+}
+
+
+void
+generate(const GeneratorOptions& options, std::ostream& out)
+{
+    check(options);
+    Random random{options.seed};
+    BlockWriter writer{out};
+
+    const std::uint64_t distinct = std::max<std::uint64_t>(1,
+            options.distinct_queries != 0
+                ? options.distinct_queries
+                : std::min<std::uint64_t>(options.queries, 1 << 20));
+    const unsigned query_depth = options.query_depth != 0
+        ? std::min(options.query_depth, options.depth) : options.depth;
+    HitSampler hits{options.depth,
+                    static_cast<std::size_t>(std::min<std::uint64_t>(
+                            distinct, 1 << 16))};
+
+    writer << 2 * options.nodes << " " << options.queries << "\n";
+
+    auto fanout = [&](void) -> std::uint64_t {
+        switch (options.fanout_distribution) {
+            case GeneratorOptions::fixed:
+                return static_cast<std::uint64_t>(std::llround(options.fanout));
+            case GeneratorOptions::uniform:
+                return random.below(static_cast<std::uint64_t>(
+                        std::llround(2 * options.fanout)) + 1);
+            case GeneratorOptions::geometric:
+                break;
+        }
+        // Failures before the first success, success chance 1/(1+mean)
+        double p = 1 / (1 + options.fanout);
+        if (p >= 1)
+            return 0;
+        return static_cast<std::uint64_t>(
+                std::floor(std::log(1 - random.real()) / std::log(1 - p)));
+    };
+
+    /*
+     * A node is a first match, so reachable by its tag path, when its
+     * parent is and no earlier sibling has its tag. last_parent[level]
+     * [tag] holds the id of the last reachable parent a node with that
+     * tag was seen under.
+     */
+    std::vector<std::vector<std::uint64_t>> last_parent(
+            options.depth + 1, std::vector<std::uint64_t>(options.tags, 0));
+    const std::uint64_t top = 1;
+    std::uint64_t next_id = top + 1;
+
+    struct Frame {
+        std::uint32_t tag;
+        std::uint64_t id;
+        std::uint64_t children;
+        std::size_t path_size;
+        bool reachable;
+    };
+    std::vector<Frame> stack;
+    std::string path, line, value;
+    std::vector<std::uint32_t> names;
+    std::uint64_t remaining = options.nodes;
+
+    auto open = [&](void) {
+        unsigned level = static_cast<unsigned>(stack.size()) + 1;
+        std::uint64_t parent = stack.empty() ? top : stack.back().id;
+        bool parent_reachable = stack.empty() || stack.back().reachable;
+        auto tag = static_cast<std::uint32_t>(random.below(options.tags));
+        std::uint64_t id = next_id++;
+        remaining--;
+
+        bool reachable = parent_reachable &&
+                         last_parent[level][tag] != parent;
+        if (parent_reachable)
+            last_parent[level][tag] = parent;
+
+        std::string tag_name = "t" + std::to_string(tag);
+        line = "<" + tag_name;
+        names.clear();
+        auto count = std::min<std::uint64_t>(
+                random.between(options.min_attributes,
+                               options.max_attributes),
+                options.names);
+        while (names.size() < count) {
+            auto name = static_cast<std::uint32_t>(
+                    random.below(options.names));
+            if (std::find(names.begin(), names.end(), name) != names.end())
+                continue;
+            names.push_back(name);
+            value.clear();
+            for (auto n = random.between(options.min_value_length,
+                                         options.max_value_length);
+                 n > 0; n--)
+                value += "abcdefghijklmnopqrstuvwxyz0123456789"[
+                        random.below(36)];
+            line += " a" + std::to_string(name) + " = \"" + value + "\"";
+        }
+        line += ">\n";
+        writer << line;
+
+        std::size_t path_size = path.size();
+        if (level > 1)
+            path += ".";
+        path += tag_name;
+        if (reachable && !names.empty())
+            hits.add(level, path + "~a" +
+                            std::to_string(names[random.below(names.size())]),
+                     random);
+
+        stack.push_back({tag, id, level < options.depth ? fanout() : 0,
+                         path_size, reachable});
+    };
+
+    while (remaining > 0) {
+        open();
+        while (!stack.empty()) {
+            Frame& frame = stack.back();
+            if (frame.children > 0 && remaining > 0) {
+                frame.children--;
+                open();
+                continue;
+            }
+            writer << "</t" << std::uint64_t{frame.tag} << ">\n";
+            path.resize(frame.path_size);
+            stack.pop_back();
+        }
+    }
+
+    // Misses are made out of hits so they look alike
+    auto query = [&](double hit_ratio) {
+        const std::string* hit = hits.pick(
+                static_cast<unsigned>(random.between(1, query_depth)),
+                random);
+        std::string text = hit != nullptr ? *hit : "t0~a0";
+        if (hit == nullptr || random.real() >= hit_ratio) {
+            if (random.below(2))
+                text = "none." + text;
+            else
+                text = text.substr(0, text.rfind('~')) + "~none";
+        }
+        return text;
+    };
+
+    if (options.skew == 0 && distinct == options.queries) {
+        for (std::uint64_t i = 0; i < options.queries; i++)
+            writer << query(options.hit_ratio) << "\n";
+        writer.flush();
+        return;
+    }
+
+    // Repeated texts: hits and misses get pools of their own, and each
+    // written query picks its pool by hit_ratio, so the ratio holds for
+    // the queries written however the repeats fall
+    std::uint64_t hit_texts = options.hit_ratio == 0 ? 0
+        : std::max<std::uint64_t>(1, static_cast<std::uint64_t>(
+                  std::llround(options.hit_ratio * distinct)));
+    std::uint64_t miss_texts = options.hit_ratio == 1 ? 0
+        : std::max<std::uint64_t>(1, distinct - std::min(hit_texts, distinct));
+    if (hit_texts + miss_texts > distinct && hit_texts > 1)
+        --hit_texts;
+    std::vector<std::string> hit_pool, miss_pool;
+    for (std::uint64_t i = 0; i < hit_texts; i++)
+        hit_pool.push_back(query(1));
+    for (std::uint64_t i = 0; i < miss_texts; i++)
+        miss_pool.push_back(query(0));
+
+    // Zipf: rank r is drawn with weight 1 / (r + 1)^skew, the same
+    // prefix sums serving both pools
+    std::vector<double> cumulative;
+    if (options.skew != 0) {
+        double total = 0;
+        for (std::uint64_t r = 0; r < std::max(hit_pool.size(),
+                                               miss_pool.size()); r++)
+            cumulative.push_back(total += std::pow(r + 1.0, -options.skew));
+    }
+    auto pick = [&](const std::vector<std::string>& pool)
+            -> const std::string& {
+        if (options.skew == 0)
+            return pool[random.below(pool.size())];
+        auto end = cumulative.begin() + pool.size();
+        auto it = std::upper_bound(cumulative.begin(), end,
+                                   random.real() * end[-1]);
+        return pool[std::min<std::size_t>(it - cumulative.begin(),
+                                          pool.size() - 1)];
+    };
+    for (std::uint64_t i = 0; i < options.queries; i++) {
+        bool hit = miss_pool.empty() ||
+            (!hit_pool.empty() && random.real() < options.hit_ratio);
+        writer << pick(hit ? hit_pool : miss_pool) << "\n";
+    }
+    writer.flush();
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef GENERATOR_HPP_
+#define GENERATOR_HPP_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace HRML {
+
+/*
+ * Shape of a generated document and of its queries. Ranges are
+ * inclusive and drawn uniformly.
+ */
+struct GeneratorOptions {
+    std::uint64_t seed = 1;
+
+    /* Exactly this many nodes, in as many roots as it takes */
+    std::uint64_t nodes = 1000;
+    /* Levels below a root, roots are level 1 */
+    unsigned depth = 6;
+    /*
+     * Children of a node above the last level: always fanout (fixed),
+     * 0 to 2 * fanout (uniform), or geometric with mean fanout, which
+     * gives a few very wide nodes.
+     */
+    enum Fanout { fixed, uniform, geometric };
+    Fanout fanout_distribution = uniform;
+    double fanout = 3;
+
+    /* Tags are t0 .. t(tags - 1), attribute names a0 .. a(names - 1) */
+    unsigned tags = 50;
+    unsigned names = 20;
+    unsigned min_attributes = 0;
+    unsigned max_attributes = 4;
+    unsigned min_value_length = 1;
+    unsigned max_value_length = 16;
+
+    std::uint64_t queries = 1000;
+    /* Share of the written queries with an answer */
+    double hit_ratio = 0.75;
+    /* Longest query path, 0: depth */
+    unsigned query_depth = 0;
+    /*
+     * Distinct query texts, 0: one per query (capped at 1M). Repeated
+     * texts are split between hits and misses by hit_ratio, at least
+     * one of each kind the ratio asks for.
+     */
+    std::uint64_t distinct_queries = 0;
+    /* Zipf exponent over the hits and over the misses, 0: even repeats */
+    double skew = 0;
+};
+
+
+/*
+ * Write a document in the format operator>> reads, the same for the same
+ * options. Output is produced as it is generated, in large blocks, so
+ * its size is not bounded by memory. Hits are queries whose first-match
+ * path ends on a node that has the attribute; they are sampled from the
+ * nodes while they are written. Misses name a tag or an attribute that
+ * does not occur. Throws std::invalid_argument for inconsistent
+ * options.
+ */
+void generate(const GeneratorOptions& options, std::ostream& out);
+
+}
+#endif
@@ -1,441 +1,199 @@
+#include "batch.h"
+#include "hrml.h"
+#include "server.h"
+
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <exception>
 #include <iostream>
-#include <istream>
-#include <sstream>
-
+#include <optional>
 #include <string>
-#include <map>
-#include <list>
-#include <vector>
-
-#include <memory>
-#include <stdexcept>
-
-namespace HRML {
-
-class Node {
-    public:
-        Node(void);
-        Node(const std::string& source);
-        Node(std::string tag, bool is_closing);
-
-        bool is_closing_node(void) { return is_closing_node_; }
-        bool is_valid(void) { return is_valid_; }
-        void set_valid(void) { is_valid_ = true; }
-
-        std::string tag(void) const;
-        std::string attribute(const std::string& key) const;
-
-        std::weak_ptr<Node> parent(void) const;
-        void set_parent(std::shared_ptr<Node> node);
-
-        void add_child(std::shared_ptr<Node> node);
-        std::weak_ptr<const Node> child(std::string childtag) const;
-
-    private:
-        std::string tag_;
-        std::map<std::string, std::string> attributes_;
-        bool is_closing_node_;
-        bool is_valid_;
-
-        std::list<std::shared_ptr<Node>> children_;
-        mutable std::weak_ptr<Node> parent_;
-};
-
-
-class Hrml {
-    public:
-        Hrml(void);
-
-        unsigned number_source_nodes(void) const { return nsrcs_; }
-        unsigned number_queries(void) const { return nqueries_; }
-
-        std::weak_ptr<const Node> root_node(std::string roottag) const;
-        friend std::istream& operator>>(std::istream& in, Hrml& hrml);
-        friend std::ostream& operator<<(std::ostream& out, Hrml& hrml);
-
-    private:
-        unsigned nsrcs_;
-        unsigned nqueries_;
-
-        std::list<std::shared_ptr<Node>> nodes_;
-
-        bool light_node_validation(std::string s);
-        bool light_query_validation(std::string s);
-
-        void init_nodes(const std::vector<std::string>& srcs);
-        void answer_queries(const std::vector<std::string>& queries);
-
-        std::vector<std::string> answers_;
-};
-
-
-/*
- * Exceptions
- * */
-
-class HrmlNumericalDescription: public std::runtime_error {
-    public:
-        HrmlNumericalDescription(const std::string& msg="")
-            :std::runtime_error(msg) {}
-};
-
-
-class HrmlNodeError: public std::runtime_error {
-    public:
-        HrmlNodeError(const std::string& msg="")
-            :std::runtime_error(msg) {}
-};
-
-
-class HrmlQueryError: public std::runtime_error {
-    public:
-        HrmlQueryError(const std::string& msg="")
-            :std::runtime_error(msg) {}
-};
-
-
-class HrmlParse: public std::runtime_error {
-    public:
-        HrmlParse(const std::string& msg="")
-            :std::runtime_error(msg) {}
-};
-
-
-class HrmlFail: public std::runtime_error {
-    public:
-        HrmlFail(const std::string& msg="")
-            :std::runtime_error(msg) {}
-};
-
-
-class HrmlIncompleteRead: public std::runtime_error {
-    public:
-        HrmlIncompleteRead(const std::string& msg="")
-            :std::runtime_error(msg) {}
-};
-
-
-Node::Node(void)
-    : is_closing_node_{false}, is_valid_{false}
-{
-
-}
-
-
-Node::Node(std::string tag, bool is_closing)
-    : tag_{tag}, is_closing_node_{is_closing}, is_valid_{true}
-{
-
-}
-
-
-Node::Node(const std::string& s)
-    : is_closing_node_{false}, is_valid_{true}
-{
-    std::string tag_name;
-    std::map<std::string, std::string> attributes;
-
-    std::istringstream iss{s}; // Input
-    char c;
-
-    c = static_cast<char>(iss.get());
-    if (c != '<') {
-        is_valid_ = false;
-        return;
-    }
-
-    c = static_cast<char>(iss.get());
-    while (isalnum(c) || c == '_' || c == '"' || c == '/') {
-        tag_name += c;
-        c = static_cast<char>(iss.get());
-    }
-
-    if (c == '>') {
-        if (tag_name[0] == '/') {
-            tag_ = tag_name.erase(0, 1);
-            is_closing_node_ = true;
-        } else
-            tag_ = tag_name;
-        is_valid_ = true;
-        return;
-    }
-
-    if (c != ' ') {
-        is_valid_ = false;
-        return;
-    }
-
-    tag_ = tag_name;
-
-    do {
-        std::string attr_name;
-        c = static_cast<char>(iss.get());
-        while (isalnum(c) || c == '_' || c == '"') {
-            if (c != '\\' && c != '"')
-                attr_name += c;
-            c = static_cast<char>(iss.get());
-        }
-
-        if (c != ' ')
-            is_valid_ = false;
-
-        c = static_cast<char>(iss.get());
-        if (c != '=')
-            is_valid_ = false;
-
-        c = static_cast<char>(iss.get());
-        if (c != ' ')
-            is_valid_ = false;
-
-        if (!is_valid_)
-            return;
-
-        c = static_cast<char>(iss.get());
-        if (c != '"')
-            is_valid_ = false;
-
-        std::string attr_value;
-        c = static_cast<char>(iss.get());
-        while (c != '"') {
-            if (c != '\\') attr_value += c;
-            c = static_cast<char>(iss.get());
-        }
-
-        c = static_cast<char>(iss.get());
-        if (c != ' ' && c != '>') {
-            is_valid_ = false;
-            return;
-        }
-        attributes_[attr_name] = attr_value;
-    } while (c == ' ');
-}
 
+namespace {
 
-std::string
-Node::tag(void) const
-{
-    return tag_;
-}
+HRML::QueryServer* running_server = nullptr;
 
 
-std::string
-Node::attribute(const std::string& key) const
+void
+stop_server(int)
 {
-    auto it = attributes_.find(key);
-    return it != attributes_.end() ? it->second : "";
+    if (running_server != nullptr)
+        running_server->stop();
 }
 
 
-std::weak_ptr<Node>
-Node::parent(void) const
+void
+usage(void)
 {
-    return parent_;
+    std::cerr << "usage: hacker_rank [--stats] [--threads N] < input\n"
+                 "       hacker_rank --serve DOCUMENT [--socket PATH]"
+                 " [--stats] [--threads N]\n"
+                 "       hacker_rank --batch [DIRECTORY] [--stats]"
+                 " [--threads N] [< inputs]\n";
 }
 
 
-void
-Node::set_parent(std::shared_ptr<Node> node)
+/* The whole of arg as a count, nothing when it is not one */
+std::optional<unsigned>
+parse_count(const char* arg)
 {
-    parent_ = node;
+    unsigned value;
+    const char* end = arg + std::strlen(arg);
+    auto [stop, error] = std::from_chars(arg, end, value);
+    if (error != std::errc() || stop != end)
+        return std::nullopt;
+    return value;
 }
 
 
+/* Counters and phase times go to stderr, after the answers */
 void
-Node::add_child(std::shared_ptr<Node> node)
+print_stats(const HRML::Stats& stats)
 {
-    children_.push_back(node);
+    std::cout.flush();
+    std::cerr << stats.summary() << "\n";
 }
 
 
-std::weak_ptr<const Node>
-Node::child(std::string childtag) const
+/* The plain HackerRank run, stdin to stdout */
+int
+answer(const HRML::Options& options)
 {
-    for (const auto& child : children_)
-        if (child->tag() == childtag) return child;
-    return std::weak_ptr<const Node>();
+    HRML::Hrml hrml{options};
+    std::cin >> hrml;
+    std::cout << hrml;
+    if (hrml.stats() != nullptr)
+        print_stats(*hrml.stats());
+    return 0;
 }
 
 
-Hrml::Hrml(void)
-    :nsrcs_{0}, nqueries_{0}
-{
-
+/*
+ * Load DOCUMENT (the usual format, its own queries are answered and
+ * dropped) and answer query lines from stdin, or from clients of a Unix
+ * socket, until end of input or SIGINT/SIGTERM. Counters go to stderr.
+ */
+int
+serve(const std::string& document, const std::string& socket_path,
+      const HRML::Options& options)
+{
+    HRML::Hrml hrml{options};
+    hrml.load_file(document);
+    hrml.clear_answers();
+
+    HRML::QueryServer server{hrml};
+    running_server = &server;
+
+    // No SA_RESTART, a blocked read or accept has to see the stop
+    struct sigaction action{};
+    action.sa_handler = stop_server;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (socket_path.empty())
+        server.serve(0, 1);
+    else
+        server.listen(socket_path);
+
+    running_server = nullptr;
+    std::cerr << server.stats().summary() << "\n";
+    if (hrml.stats() != nullptr)
+        print_stats(*hrml.stats());
+    return 0;
 }
 
 
-void
-Hrml::init_nodes(const std::vector<std::string>& srcs)
-{
-    std::shared_ptr<Node> current_node;
-
-    for (const auto& src : srcs) {
-        auto node = std::make_shared<Node>(src);
-        if (!node->is_valid())
-            throw HrmlParse("Non-valid node: " + node->tag());
-
-        if (node->is_closing_node()) {
-            if (current_node == nullptr)
-                throw HrmlParse("Error parsing - bad tag: " + node->tag());
-
-            if (current_node->tag() == node->tag())
-                current_node = current_node->parent().lock();
-            else
-                throw HrmlParse("Error parsing - bad tag: " + node->tag());
-        }  else {
-            if (current_node == nullptr) {
-                nodes_.push_back(node);
-            } else {
-                current_node->add_child(node);
-                node->set_parent(current_node);
-            }
-            current_node = node;
+/*
+ * Answer every file of directory, or every document concatenated on
+ * stdin when directory is empty, in parallel. Answers go to stdout in
+ * input order, failed documents to stderr; the status is 1 if any
+ * failed.
+ */
+int
+batch(const std::string& directory, const HRML::Options& options,
+      unsigned threads)
+{
+    HRML::Batch batch{options, threads};
+    HRML::Stats stats;
+    bool failed = false;
+    auto report = [&](const HRML::BatchResult& result) {
+        stats += result.stats;
+        if (result.error.empty()) {
+            std::cout << result.answers;
+            return;
         }
+        std::cout.flush();
+        std::cerr << "hacker_rank: " << result.name << ": " << result.error
+                  << "\n";
+        failed = true;
+    };
+
+    if (directory.empty()) {
+        batch.answer_stream(std::cin, report);
+    } else {
+        for (const auto& result : batch.answer_directory(directory))
+            report(result);
     }
-}
-
-
-void
-Hrml::answer_queries(const std::vector<std::string>& queries)
-{
-
-    for (const auto& query : queries)
-    {
-        char c;
-        std::istringstream iss{query};
-        std::string tag;
-        std::string value;
-        std::weak_ptr<const Node> node;
-        bool root_search = true;
-
-        while (!iss.eof()) {
-            c = static_cast<char>(iss.get());
-            if (c == '.' || c == '~') {
-                if (root_search) {
-                    node = root_node(tag);
-                    if (!node.lock()) {
-                        value = "";
-                        break;
-                    }
-                    root_search = false;
-                } else {
-                    if (auto n = node.lock())
-                        node = n->child(tag);
-                    if (!node.lock()) {
-                        value = "";
-                        break;
-                    }
-                }
-                if (c == '~') {
-                    iss >> value;
-                    if (auto n = node.lock())
-                        value = n->attribute(value);
-                    else
-                        value = "";
-                }
-                tag.clear();
-            } else {
-                tag += c;
+    std::cout.flush();
+    if (options.stats)
+        print_stats(stats);
+    return failed ? 1 : 0;
+}
+
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string document, socket_path, directory;
+    bool batch_mode = false;
+    HRML::Options options;
+    std::optional<unsigned> threads;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stats")
+            options.stats = true;
+        else if (arg == "--serve" && i + 1 < argc)
+            document = argv[++i];
+        else if (arg == "--socket" && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (arg == "--batch") {
+            batch_mode = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                directory = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = parse_count(argv[++i]);
+            if (!threads) {
+                std::cerr << "hacker_rank: --threads needs a count, not \""
+                          << argv[i] << "\"\n";
+                usage();
+                return 2;
             }
+        } else {
+            usage();
+            return 2;
         }
-        answers_.push_back(!value.empty() ? value : std::string("Not Found!"));
     }
-
-}
-
-
-std::weak_ptr<const Node>
-Hrml::root_node(std::string roottag) const
-{
-    for (const auto& child : nodes_)
-        if (child->tag() == roottag) return child;
-    return std::weak_ptr<const Node>();
-}
-
-
-bool
-Hrml::light_node_validation(std::string s)
-{
-    return s.find('<') != std::string::npos &&
-           s.find('>') != std::string::npos;
-}
-
-
-bool
-Hrml::light_query_validation(std::string s)
-{
-    return s.find('~') != std::string::npos;
-}
-
-
-std::istream&
-operator>>(std::istream& in, Hrml& hrml)
-{
-    std::string s;
-
-    /*
-     * Read hrml line number description (hrml nodes, hrml queries)
-     */
-    std::getline(in, s);
-    std::istringstream iss{s};
-    iss >> hrml.nsrcs_ >> hrml.nqueries_;
-    if (iss.fail())
-        throw HrmlNumericalDescription();
-
-    /*
-     * Read hrml nodes
-     */
-    std::vector<std::string> hrml_srcs;
-    for(unsigned i = 0; i < hrml.nsrcs_ && !in.fail(); i++) {
-        std::getline(in, s);
-        if (!hrml.light_node_validation(s))
-            throw HrmlNodeError();
-        hrml_srcs.push_back(s);
+    if ((batch_mode && !document.empty()) ||
+        (!socket_path.empty() && document.empty())) {
+        usage();
+        return 2;
     }
 
-    hrml.init_nodes(hrml_srcs);
-
-    /*
-     * Read hrml queries
-     */
-    std::vector<std::string> hrml_queries;
-    for(unsigned i = 0; i < hrml.nqueries_ && !in.fail(); i++) {
-        std::getline(in, s);
-        if (!hrml.light_query_validation(s))
-            throw HrmlQueryError();
-        hrml_queries.push_back(s);
+    // Batches spread documents over the threads, the rest a document
+    if (threads && !batch_mode)
+        options.parse_threads = options.query_threads = *threads;
+    if (!batch_mode && document.empty())
+        return answer(options);
+
+    try {
+        if (batch_mode)
+            return batch(directory, options, threads.value_or(0));
+        return serve(document, socket_path, options);
+    } catch (const std::exception& e) {
+        std::cerr << "hacker_rank: " << e.what() << "\n";
+        return 1;
     }
-
-    if (in.fail())
-        // Fail happened when reading hrml file
-        throw HrmlFail();
-
-    std::getline(in, s); // Control end-of-line
-    if (!in.eof())
-        // Wrong line number description in hrml file
-        throw HrmlIncompleteRead();
-
-    hrml.answer_queries(hrml_queries);
-
-    return in;
-}
-
-
-std::ostream&
-operator<<(std::ostream& out, Hrml& hrml)
-{
-    for (const auto& answer : hrml.answers_)
-        out << answer + "\n";
-    return out;
-}
-
-} /* <-- end namespace hrml */
-
-
-int main(void)
-{
-    HRML::Hrml hrml;
-    std::cin >> hrml;
-    std::cout << hrml;
-
-    return 0;
 }
@@ -1,169 +1,571 @@
 #include "hrml.h"
+#include "events.h"
+#include "mapped_file.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
 #include <sstream>
 #include <stdexcept>
+#include <system_error>
+#include <unordered_map>
 
 namespace HRML {
 
+// One copy of the text, every miss is a view of it
+const std::string_view Hrml::not_found{"Not Found!"};
+
+
 Hrml::Hrml(void)
-    :nsrcs_{0}, nqueries_{0}
+    :Hrml(Options())
 {
 
 }
 
 
-void
-Hrml::init_nodes(const std::vector<std::string>& srcs)
+Hrml::Hrml(const Options& options)
+    :options_{options}, nsrcs_{0}, nqueries_{0},
+     plans_{options.query_cache_size}
 {
-    std::shared_ptr<Node> current_node;
+    tree_.set_path_index(options.path_index);
+    if (options.stats)
+        stats_ = std::make_unique<Stats>();
+}
 
-    for (const auto& src : srcs) {
-        auto node = std::make_shared<Node>(src);
-        if (!node->is_valid())
-            throw HrmlParse("Non-valid node: " + node->tag());
 
-        if (node->is_closing_node()) {
-            if (current_node == nullptr)
-                throw HrmlParse("Error parsing - bad tag: " + node->tag());
+namespace {
 
-            if (current_node->tag() == node->tag())
-                current_node = current_node->parent().lock();
-            else
-                throw HrmlParse("Error parsing - bad tag: " + node->tag());
-        }  else {
-            if (current_node == nullptr) {
-                nodes_.push_back(node);
-            } else {
-                current_node->add_child(node);
-                node->set_parent(current_node);
-            }
-            current_node = node;
+/* Adds the time between start() and stop() to *slot, when there is one */
+class PhaseTimer {
+    public:
+        explicit PhaseTimer(std::chrono::nanoseconds* slot, bool started = true)
+            : slot_{slot}
+        {
+            if (started)
+                start();
+        }
+
+        void start(void)
+        {
+            if (slot_ != nullptr)
+                start_ = std::chrono::steady_clock::now();
+        }
+
+        void stop(void)
+        {
+            if (slot_ != nullptr)
+                *slot_ += std::chrono::steady_clock::now() - start_;
+        }
+
+    private:
+        std::chrono::nanoseconds* slot_;
+        std::chrono::steady_clock::time_point start_;
+};
+
+
+/*
+ * Builds the node tree out of parse events. Open/close matching is done
+ * by its EventParser, which shares the tree's symbol table so each tag is
+ * interned once and closing tags are matched by symbol.
+ */
+class TreeBuilder: public EventHandler {
+    public:
+        /* New nodes go below parent, no_node: as roots */
+        TreeBuilder(Tree& tree, bool lazy, NodeIndex parent = no_node)
+            : tree_{tree}, lazy_{lazy}, current_node_{parent},
+              parser_{*this, &tree.symbols()} {}
+
+        void feed(std::string_view line)
+        {
+            line_ = line;
+            parser_.feed(line);
+        }
+
+        /* token was tokenized from line */
+        void feed(const Token& token, std::string_view line)
+        {
+            line_ = line;
+            parser_.feed(token);
+        }
+
+        /* Nodes added so far, and the deepest level reached below parent */
+        std::uint64_t nodes(void) const { return nodes_; }
+        std::uint32_t max_depth(void) const { return max_depth_; }
+
+        void on_open(std::string_view,
+                     const std::vector<TokenAttribute>& attributes) override
+        {
+            ++nodes_;
+            max_depth_ = std::max(max_depth_, ++depth_);
+            current_node_ = lazy_
+                ? tree_.add_lazy(current_node_, parser_.symbol(), line_,
+                                 attributes)
+                : tree_.add(current_node_, parser_.symbol(), attributes);
         }
+
+        void on_close(std::string_view) override
+        {
+            --depth_;
+            current_node_ = tree_.element(current_node_).parent;
+        }
+
+    private:
+        Tree& tree_;
+        bool lazy_;
+        std::string_view line_;
+        NodeIndex current_node_;
+        std::uint64_t nodes_ = 0;
+        std::uint32_t depth_ = 0;
+        std::uint32_t max_depth_ = 0;
+        EventParser parser_;
+};
+
+}
+
+
+void
+Hrml::init_nodes(const std::vector<std::string_view>& srcs)
+{
+    TreeBuilder builder{tree_, options_.lazy_attributes};
+
+    // Plans resolved names against the symbols we are about to extend
+    plans_.clear();
+
+    const bool parallel = options_.parse_threads != 1 &&
+                          srcs.size() > options_.parse_chunk;
+    if (!parallel && !stats_) {
+        for (const auto& src : srcs)
+            builder.feed(src);
+        tree_.build_child_indexes();
+        return;
+    }
+
+    /*
+     * Tokenize a window of lines (in parallel when asked), then feed it
+     * in order so linking and error reporting stay those of the
+     * sequential path. Tokens are reused across windows to keep their
+     * attribute buffers.
+     */
+    ThreadPool* pool = parallel ? &thread_pool(options_.parse_threads)
+                                : nullptr;
+    const std::size_t chunk = options_.parse_chunk;
+    std::vector<Token> tokens(std::min(srcs.size(),
+                                       chunk * (pool ? pool->size() : 1) * 4));
+    PhaseTimer tokenizing{stats_ ? &stats_->tokenize_time : nullptr, false};
+    PhaseTimer linking{stats_ ? &stats_->link_time : nullptr, false};
+
+    for (std::size_t base = 0; base < srcs.size(); base += tokens.size()) {
+        std::size_t n = std::min(tokens.size(), srcs.size() - base);
+        auto tokenize_lines = [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; i++)
+                tokenize(srcs[base + i], tokens[i]);
+        };
+        tokenizing.start();
+        if (pool != nullptr)
+            pool->parallel_for(n, chunk, tokenize_lines);
+        else
+            tokenize_lines(0, n);
+        tokenizing.stop();
+
+        linking.start();
+        for (std::size_t i = 0; i < n; i++)
+            builder.feed(tokens[i], srcs[base + i]);
+        linking.stop();
+    }
+    linking.start();
+    tree_.build_child_indexes();
+    linking.stop();
+    if (stats_) {
+        stats_->nodes += builder.nodes();
+        stats_->max_depth = std::max<std::uint64_t>(stats_->max_depth,
+                                                    builder.max_depth());
     }
 }
 
 
 void
-Hrml::answer_queries(const std::vector<std::string>& queries)
-{
-
-    for (const auto& query : queries)
-    {
-        char c;
-        std::istringstream iss{query};
-        std::string tag;
-        std::string value;
-        std::weak_ptr<const Node> node;
-        bool root_search = true;
-
-        while (!iss.eof()) {
-            c = static_cast<char>(iss.get());
-            if (c == '.' || c == '~') {
-                if (root_search) {
-                    node = root_node(tag);
-                    if (!node.lock()) {
-                        value = "";
-                        break;
-                    }
-                    root_search = false;
-                } else {
-                    if (auto n = node.lock())
-                        node = n->child(tag);
-                    if (!node.lock()) {
-                        value = "";
-                        break;
-                    }
-                }
-                if (c == '~') {
-                    iss >> value;
-                    if (auto n = node.lock())
-                        value = n->attribute(value);
-                    else
-                        value = "";
-                }
-                tag.clear();
-            } else {
-                tag += c;
-            }
+Hrml::answer_queries(const std::vector<std::string_view>& queries)
+{
+    PhaseTimer querying{stats_ ? &stats_->query_time : nullptr};
+
+    // Each distinct text goes through the plan cache once
+    std::unordered_map<std::string_view, std::uint32_t> distinct;
+    std::vector<QueryCache::Lookup> plans;
+    std::vector<std::uint32_t> text(queries.size());
+    for (std::size_t i = 0; i < queries.size(); i++) {
+        auto it = distinct.emplace(queries[i],
+                                   static_cast<std::uint32_t>(plans.size()));
+        if (it.second)
+            plans.push_back({queries[i], 0, nullptr});
+        text[i] = it.first->second;
+        ++plans[text[i]].uses;
+    }
+
+    std::vector<const QueryPlan*> batch(queries.size());
+    const std::size_t base = answers_.size();
+    answers_.resize(base + queries.size());
+
+    // Lookups, and the compiling of misses, are shared out like queries
+    auto lookup = [&](std::size_t begin, std::size_t end) {
+        plans_.plans(plans.data() + begin, end - begin, tree_.symbols());
+    };
+    std::atomic<std::uint64_t> child_steps{0};
+    auto answer = [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++)
+            batch[i] = plans[text[i]].plan.get();
+        std::uint64_t steps = 0;
+        auto values = run_queries(batch.data() + begin, end - begin, tree_,
+                                  stats_ ? &steps : nullptr);
+        for (std::size_t i = 0; i < values.size(); i++)
+            answers_[base + begin + i] = values[i] != nullptr
+                ? *values[i] : not_found;
+        child_steps.fetch_add(steps, std::memory_order_relaxed);
+    };
+
+    if (options_.query_threads == 1 || queries.size() <= options_.query_chunk) {
+        lookup(0, plans.size());
+        answer(0, queries.size());
+    } else {
+        ThreadPool& pool = thread_pool(options_.query_threads);
+        // A miss costs about as much to compile as a few answers
+        pool.parallel_for(plans.size(),
+                          std::min<std::size_t>(options_.query_chunk, 1024),
+                          lookup);
+        pool.parallel_for(queries.size(), options_.query_chunk, answer);
+    }
+    querying.stop();
+
+    if (stats_) {
+        stats_->child_steps += child_steps.load(std::memory_order_relaxed);
+        stats_->queries += queries.size();
+        for (std::size_t i = 0; i < queries.size(); i++) {
+            if (answers_[base + i].data() == not_found.data())
+                stats_->misses++;
+            else
+                stats_->hits++;
         }
-        answers_.push_back(!value.empty() ? value : std::string("Not Found!"));
     }
+}
+
+
+std::string_view
+Hrml::answer(std::string_view query) const
+{
+    const std::string_view* value = run_query(compile_query(query,
+                                                            tree_.symbols()),
+                                              tree_);
+    return value != nullptr ? *value : not_found;
+}
+
+
+namespace {
+
+/* Checks lines without building anything */
+class NullHandler: public EventHandler {
+    public:
+        void on_open(std::string_view,
+                     const std::vector<TokenAttribute>&) override {}
+        void on_close(std::string_view) override {}
+};
+
+}
+
+
+NodeRef
+Hrml::insert(NodeRef parent, std::string_view source)
+{
+    std::vector<std::string_view> lines;
+    while (!source.empty()) {
+        auto nl = source.find('\n');
+        lines.push_back(source.substr(0, nl));
+        source.remove_prefix(nl != std::string_view::npos
+                             ? nl + 1 : source.size());
+    }
+
+    // Validate everything first so a bad line changes nothing
+    NullHandler null;
+    EventParser check{null};
+    for (const auto& line : lines) {
+        if (!light_node_validation(line))
+            throw HrmlNodeError();
+        check.feed(line);
+    }
+    if (check.depth() != 0)
+        throw HrmlParse("Error parsing - unclosed tag");
+
+    std::size_t symbols = tree_.symbols().size();
+    auto first = static_cast<NodeIndex>(tree_.size());
+    TreeBuilder builder{tree_, false, parent ? parent.index() : no_node};
+    for (const auto& line : lines)
+        builder.feed(line);
+    symbols_changed(symbols);
 
+    return lines.empty() ? NodeRef() : NodeRef(&tree_, first);
 }
 
 
-std::weak_ptr<const Node>
-Hrml::root_node(std::string roottag) const
+void
+Hrml::remove(NodeRef node)
 {
-    for (const auto& child : nodes_)
-        if (child->tag() == roottag) return child;
-    return std::weak_ptr<const Node>();
+    tree_.remove(node.index());
+}
+
+
+void
+Hrml::set_attribute(NodeRef node, std::string_view name,
+                    std::string_view value)
+{
+    std::size_t symbols = tree_.symbols().size();
+    tree_.set_attribute(node.index(), tree_.symbols().intern(name), value);
+    symbols_changed(symbols);
 }
 
 
 bool
-Hrml::light_node_validation(std::string s)
+Hrml::remove_attribute(NodeRef node, std::string_view name)
+{
+    Symbol key = tree_.symbols().find(name);
+    return key != no_symbol && tree_.remove_attribute(node.index(), key);
+}
+
+
+/* Plans resolved names against the table as it was */
+void
+Hrml::symbols_changed(std::size_t before)
 {
-    return s.find('<') != std::string::npos &&
-           s.find('>') != std::string::npos;
+    if (tree_.symbols().size() != before)
+        plans_.clear();
+}
+
+
+ThreadPool&
+Hrml::thread_pool(unsigned threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    if (!pool_ || pool_->size() != threads)
+        pool_ = std::make_unique<ThreadPool>(threads);
+    return *pool_;
+}
+
+
+NodeRef
+Hrml::root_node(std::string_view roottag) const
+{
+    Symbol symbol = tree_.symbols().find(roottag);
+    return symbol != no_symbol ? tree_.root(symbol) : NodeRef();
 }
 
 
 bool
-Hrml::light_query_validation(std::string s)
+Hrml::light_node_validation(std::string_view s)
 {
-    return s.find('~') != std::string::npos;
+    return has_brackets(s);
 }
 
 
-std::istream&
-operator>>(std::istream& in, Hrml& hrml)
+bool
+Hrml::light_query_validation(std::string_view s)
+{
+    return s.find('~') != std::string_view::npos;
+}
+
+
+namespace {
+
+/*
+ * Line sources for Hrml::read(). Both follow std::getline() semantics:
+ * reading past the last line sets fail and eof, and a last line without
+ * '\n' sets eof only. Returned views stay valid until the source dies.
+ */
+class StreamLines {
+    public:
+        /* Lines are kept in store */
+        StreamLines(std::istream& in, std::deque<std::string>& store)
+            : in_{in}, lines_{store} {}
+
+        void getline(std::string_view& line)
+        {
+            lines_.emplace_back();
+            std::getline(in_, lines_.back());
+            line = lines_.back();
+        }
+
+        bool fail(void) const { return in_.fail(); }
+        bool eof(void) const { return in_.eof(); }
+
+    private:
+        std::istream& in_;
+        std::deque<std::string>& lines_;
+};
+
+
+class BufferLines {
+    public:
+        BufferLines(std::string_view buf)
+            : buf_{buf}, pos_{0}, fail_{false}, eof_{false} {}
+
+        void getline(std::string_view& line)
+        {
+            if (pos_ == buf_.size()) {
+                fail_ = eof_ = true;
+                line = std::string_view();
+                return;
+            }
+            auto nl = buf_.find('\n', pos_);
+            if (nl == std::string_view::npos) {
+                line = buf_.substr(pos_);
+                pos_ = buf_.size();
+                eof_ = true;
+            } else {
+                line = buf_.substr(pos_, nl - pos_);
+                pos_ = nl + 1;
+            }
+        }
+
+        bool fail(void) const { return fail_; }
+        bool eof(void) const { return eof_; }
+
+    private:
+        std::string_view buf_;
+        std::size_t pos_;
+        bool fail_;
+        bool eof_;
+};
+
+}
+
+
+template <class Lines>
+void
+Hrml::read(Lines& lines)
 {
-    std::string s;
+    std::string_view s;
+    PhaseTimer reading{stats_ ? &stats_->read_time : nullptr};
 
     /*
      * Read hrml line number description (hrml nodes, hrml queries)
      */
-    std::getline(in, s);
-    std::istringstream iss{s};
-    iss >> hrml.nsrcs_ >> hrml.nqueries_;
+    lines.getline(s);
+    const std::size_t header_size = s.size();
+    std::istringstream iss{std::string(s)};
+    iss >> nsrcs_ >> nqueries_;
     if (iss.fail())
         throw HrmlNumericalDescription();
 
     /*
      * Read hrml nodes
      */
-    std::vector<std::string> hrml_srcs;
-    for(unsigned i = 0; i < hrml.nsrcs_ && !in.fail(); i++) {
-        std::getline(in, s);
-        if (!hrml.light_node_validation(s))
+    std::vector<std::string_view> hrml_srcs;
+    for(unsigned i = 0; i < nsrcs_ && !lines.fail(); i++) {
+        lines.getline(s);
+        if (!light_node_validation(s))
             throw HrmlNodeError();
         hrml_srcs.push_back(s);
     }
 
-    hrml.init_nodes(hrml_srcs);
+    reading.stop();
+    init_nodes(hrml_srcs);
+    reading.start();
 
     /*
      * Read hrml queries
      */
-    std::vector<std::string> hrml_queries;
-    for(unsigned i = 0; i < hrml.nqueries_ && !in.fail(); i++) {
-        std::getline(in, s);
-        if (!hrml.light_query_validation(s))
+    std::vector<std::string_view> hrml_queries;
+    for(unsigned i = 0; i < nqueries_ && !lines.fail(); i++) {
+        lines.getline(s);
+        if (!light_query_validation(s))
             throw HrmlQueryError();
         hrml_queries.push_back(s);
     }
 
-    if (in.fail())
+    if (lines.fail())
         // Fail happened when reading hrml file
         throw HrmlFail();
 
-    std::getline(in, s); // Control end-of-line
-    if (!in.eof())
+    lines.getline(s); // Control end-of-line
+    if (!lines.eof())
         // Wrong line number description in hrml file
         throw HrmlIncompleteRead();
+    reading.stop();
+
+    if (stats_) {
+        stats_->lines += 1 + hrml_srcs.size() + hrml_queries.size();
+        stats_->bytes += header_size + 1;
+        for (const auto& src : hrml_srcs)
+            stats_->bytes += src.size() + 1;
+        for (const auto& query : hrml_queries)
+            stats_->bytes += query.size() + 1;
+    }
+    answer_queries(hrml_queries);
+}
 
-    hrml.answer_queries(hrml_queries);
 
+void
+Hrml::load_file(const std::string& path)
+{
+    std::shared_ptr<const MappedFile> file;
+    try {
+        file = std::make_shared<const MappedFile>(path);
+    } catch (const std::system_error& e) {
+        throw HrmlFail(e.what());
+    }
+
+    // Lazy nodes point into the mapping, even when reading fails halfway
+    if (options_.lazy_attributes)
+        sources_.push_back(file);
+    BufferLines lines{file->view()};
+    read(lines);
+}
+
+
+void
+Hrml::save_snapshot(const std::string& path) const
+{
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    if (!out)
+        throw HrmlFail("can not write " + path);
+    write_snapshot(tree_, out);
+    out.close();
+    if (!out)
+        throw HrmlFail("can not write " + path);
+}
+
+
+void
+Hrml::open_snapshot(const std::string& path)
+{
+    std::shared_ptr<const MappedFile> file;
+    try {
+        file = std::make_shared<const MappedFile>(path);
+    } catch (const std::system_error& e) {
+        throw HrmlFail(e.what());
+    }
+
+    // Read aside, a bad snapshot leaves the loaded document alone
+    Tree tree;
+    tree.set_path_index(tree_.path_index());
+    unsigned nodes = read_snapshot(file->view(), tree);
+
+    answers_.clear();
+    plans_.clear();
+    tree_.swap(tree);
+    sources_.clear();
+    sources_.push_back(file);
+    nsrcs_ = 2 * nodes;
+    nqueries_ = 0;
+}
+
+
+std::istream&
+operator>>(std::istream& in, Hrml& hrml)
+{
+    auto store = std::make_shared<std::deque<std::string>>();
+    if (hrml.options_.lazy_attributes)
+        hrml.sources_.push_back(store);
+    StreamLines lines{in, *store};
+    hrml.read(lines);
     return in;
 }
 
@@ -171,9 +573,62 @@ operator>>(std::istream& in, Hrml& hrml)
 std::ostream&
 operator<<(std::ostream& out, Hrml& hrml)
 {
-    for (const auto& answer : hrml.answers_)
-        out << answer + "\n";
+    PhaseTimer writing{hrml.stats_ ? &hrml.stats_->write_time : nullptr};
+
+    // Answers are gathered in a buffer and written in large blocks
+    constexpr std::size_t block = 1 << 16;
+    std::string buffer;
+    buffer.reserve(block);
+
+    for (const auto& answer : hrml.answers_) {
+        if (buffer.size() + answer.size() + 1 > block && !buffer.empty()) {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+        buffer.append(answer);
+        buffer.push_back('\n');
+    }
+    out.write(buffer.data(), buffer.size());
+    writing.stop();
     return out;
 }
 
+
+Stats&
+Stats::operator+=(const Stats& other)
+{
+    read_time += other.read_time;
+    tokenize_time += other.tokenize_time;
+    link_time += other.link_time;
+    query_time += other.query_time;
+    write_time += other.write_time;
+    lines += other.lines;
+    bytes += other.bytes;
+    nodes += other.nodes;
+    max_depth = std::max(max_depth, other.max_depth);
+    queries += other.queries;
+    hits += other.hits;
+    misses += other.misses;
+    child_steps += other.child_steps;
+    return *this;
+}
+
+
+std::string
+Stats::summary(void) const
+{
+    auto ms = [](std::chrono::nanoseconds ns) {
+        return std::chrono::duration<double, std::milli>(ns).count();
+    };
+    std::ostringstream out;
+    out << "read " << ms(read_time) << " ms " << lines << " lines "
+        << bytes << " B tokenize " << ms(tokenize_time) << " ms link "
+        << ms(link_time) << " ms nodes " << nodes << " depth " << max_depth
+        << " queries " << queries << " in " << ms(query_time) << " ms hits "
+        << hits << " not found " << misses << " child steps " << child_steps
+        << " (" << (queries ? double(child_steps) / queries : 0.0)
+        << " per query) write " << ms(write_time) << " ms";
+    return out.str();
+}
+
 } /* <-- end namespace hrml */
@@ -2,40 +2,228 @@
 #define INPUT_HPP_
 
 #include "node.h"
+#include "query_cache.h"
+#include "thread_pool.h"
+#include "tree.h"
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include <map>
-#include <list>
 #include <string>
+#include <string_view>
 #include <istream>
 
 namespace HRML {
 
+/*
+ * Tuning knobs for Hrml, the defaults give the plain sequential parser.
+ */
+struct Options {
+    /*
+     * Node lines are tokenized by this many threads (0: one per hardware
+     * thread) in chunks of parse_chunk lines. Linking the tree is always
+     * done in a single pass afterwards, in document order.
+     */
+    unsigned parse_threads = 1;
+    std::size_t parse_chunk = 4096;
+
+    /* Compiled query plans kept, least recently used go first */
+    std::size_t query_cache_size = 4096;
+
+    /*
+     * Queries are answered by this many threads (0: one per hardware
+     * thread) in chunks of query_chunk queries, each chunk writing its
+     * own answer slots. Answers keep the order of the queries.
+     */
+    unsigned query_threads = 1;
+    std::size_t query_chunk = 16384;
+
+    /*
+     * Hash every node's full tag path while parsing so a query path is
+     * one lookup whatever its depth. Costs memory (see
+     * Hrml::path_index_bytes()) and parse time, so it is off by default.
+     */
+    bool path_index = false;
+
+    /*
+     * Check and link every node up front but leave attribute values in
+     * the source text until a query reads them. The text read is kept
+     * for as long as the Hrml. Answers are those of the eager mode.
+     */
+    bool lazy_attributes = false;
+
+    /*
+     * Keep Stats. Off, the only cost is a null check per phase and
+     * per child lookup; on, node lines are tokenized in windows ahead of
+     * linking so the two can be timed apart. Nodes and child lookups are
+     * counted as they happen.
+     */
+    bool stats = false;
+};
+
+
+/*
+ * What an Hrml did, summed over every document read and every
+ * answer_queries() call. Times are wall clock. answer() is not counted.
+ */
+struct Stats {
+    /* Reading and checking the header, node and query lines */
+    std::chrono::nanoseconds read_time{0};
+    std::chrono::nanoseconds tokenize_time{0};
+    /* Building the tree from tokens, child tables included */
+    std::chrono::nanoseconds link_time{0};
+    std::chrono::nanoseconds query_time{0};
+    /* operator<< */
+    std::chrono::nanoseconds write_time{0};
+
+    std::uint64_t lines = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t nodes = 0;
+    /* Roots are at depth 1 */
+    std::uint64_t max_depth = 0;
+
+    std::uint64_t queries = 0;
+    std::uint64_t hits = 0;
+    /* Answered "Not Found!" */
+    std::uint64_t misses = 0;
+    /*
+     * Child table slots and children looked at by exact descend steps,
+     * as answering ran them: prefixes shared within a batch are counted
+     * once, and path index lookups not at all.
+     */
+    std::uint64_t child_steps = 0;
+
+    /* Sums the counters, keeps the larger max_depth */
+    Stats& operator+=(const Stats& other);
+
+    /* One line: phase times, sizes, query outcomes */
+    std::string summary(void) const;
+};
+
+
 class Hrml {
     public:
         Hrml(void);
+        explicit Hrml(const Options& options);
 
         unsigned number_source_nodes(void) const { return nsrcs_; }
         unsigned number_queries(void) const { return nqueries_; }
 
-        std::weak_ptr<const Node> root_node(std::string roottag) const;
+        NodeRef root_node(std::string_view roottag) const;
+        /* First root in document order, the others follow as siblings */
+        NodeRef first_root(void) const
+        {
+            return NodeRef(&tree_, tree_.first_root());
+        }
+        const QueryCache& query_cache(void) const { return plans_; }
+        /* nullptr unless Options::stats is set */
+        const Stats* stats(void) const { return stats_.get(); }
+        void reset_stats(void)
+        {
+            if (stats_)
+                *stats_ = Stats();
+        }
+        std::size_t path_index_bytes(void) const
+        {
+            return tree_.path_index_bytes();
+        }
+
+        /*
+         * Same as reading the file through operator>>, but the file is
+         * mmapped and lines are parsed in place.
+         */
+        void load_file(const std::string& path);
+
+        /*
+         * Write the document as a binary snapshot (see snapshot.h),
+         * without the queries. open_snapshot() replaces the document
+         * with one, mapping the file and reading the tables in place:
+         * nothing is parsed and attribute values stay views of the
+         * mapping. Nodes and child tables are still set up one by one,
+         * so opening is linear in the node count. The file stays mapped
+         * for as long as the Hrml. Bad files throw HrmlSnapshotError and
+         * leave the loaded document as it was.
+         */
+        void save_snapshot(const std::string& path) const;
+        void open_snapshot(const std::string& path);
+
+        /*
+         * Answer more queries against the loaded document. Answers are
+         * appended, in order, to the ones operator<< prints. They are
+         * views of attribute text the tree never moves, or of the shared
+         * not_found text, so they need no allocation and stay valid as
+         * more documents are read or the document is edited.
+         */
+        static const std::string_view not_found;
+        void answer_queries(const std::vector<std::string_view>& queries);
+        const std::vector<std::string_view>& answers(void) const
+        {
+            return answers_;
+        }
+        void clear_answers(void) { answers_.clear(); }
+
+        /*
+         * Edit the loaded document in place. Lookup structures (root and
+         * child tables, path index, tag index) are updated in place
+         * rather than rebuilt, mostly at a cost that follows the size of
+         * the edit. The exceptions are linear in a neighbourhood, not in
+         * the document: removing the first child (or root) with some tag
+         * walks its later siblings for the next one, O(fanout); removing
+         * a root shifts the later roots, O(roots); and once a pattern
+         * query has built the tag index, each added or removed node
+         * shifts the later entries of its tag's list, O(nodes with that
+         * tag), with an occasional relabelling amortized to O(log^2 n).
+         *
+         * insert() appends the subtrees written in source (node lines,
+         * '\n' separated, every tag closed) as the last children of
+         * parent, or as the last roots for a null parent, and returns the
+         * first one. It throws HrmlNodeError or HrmlParse like reading
+         * does, leaving the document as it was.
+         *
+         * Stored answers keep the values they had. Handles to removed
+         * nodes must not be used.
+         */
+        NodeRef insert(NodeRef parent, std::string_view source);
+        void remove(NodeRef node);
+        void set_attribute(NodeRef node, std::string_view name,
+                           std::string_view value);
+        /* false when the node had no such attribute */
+        bool remove_attribute(NodeRef node, std::string_view name);
+
+        /*
+         * Answer one query without touching the plan cache or the stored
+         * answers, so any number of threads can call it at once.
+         */
+        std::string_view answer(std::string_view query) const;
+
         friend std::istream& operator>>(std::istream& in, Hrml& hrml);
         friend std::ostream& operator<<(std::ostream& out, Hrml& hrml);
 
     private:
+        Options options_;
         unsigned nsrcs_;
         unsigned nqueries_;
 
-        std::list<std::shared_ptr<Node>> nodes_;
+        Tree tree_;
+
+        bool light_node_validation(std::string_view s);
+        bool light_query_validation(std::string_view s);
 
-        bool light_node_validation(std::string s);
-        bool light_query_validation(std::string s);
+        template <class Lines> void read(Lines& lines);
+        void init_nodes(const std::vector<std::string_view>& srcs);
+        void symbols_changed(std::size_t before);
+        ThreadPool& thread_pool(unsigned threads);
 
-        void init_nodes(const std::vector<std::string>& srcs);
-        void answer_queries(const std::vector<std::string>& queries);
+        /* Text lazy nodes point into (line deques, mapped files) */
+        std::vector<std::shared_ptr<const void>> sources_;
 
-        std::vector<std::string> answers_;
+        std::unique_ptr<ThreadPool> pool_;
+        QueryCache plans_;
+        std::vector<std::string_view> answers_;
+        std::unique_ptr<Stats> stats_;
 };
 
 
@@ -84,5 +272,12 @@ class HrmlIncompleteRead: public std::runtime_error {
             :std::runtime_error(msg) {}
 };
 
+
+class HrmlSnapshotError: public std::runtime_error {
+    public:
+        HrmlSnapshotError(const std::string& msg="")
+            :std::runtime_error(msg) {}
+};
+
 }  /* <-- end of namespace hrml */
 #endif
@@ -0,0 +1,32 @@
+#ifndef MAPPED_FILE_HPP_
+#define MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace HRML {
+
+/*
+ * Read-only memory mapping of a whole file, unmapped on destruction.
+ * Throws std::system_error when the file can not be opened or mapped.
+ */
+class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path);
+        ~MappedFile(void);
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data(void) const { return data_; }
+        std::size_t size(void) const { return size_; }
+        std::string_view view(void) const { return {data_, size_}; }
+
+    private:
+        const char* data_;
+        std::size_t size_;
+};
+
+}
+#endif
@@ -2,9 +2,11 @@
 #define NODE_HPP_
 
 #include <string>
-#include <map>
-#include <list>
-#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "flat_map.h"
+#include "tokenizer.h"
 
 namespace HRML {
 
@@ -12,6 +14,8 @@ class Node {
     public:
         Node(void);
         Node(const std::string& source);
+        explicit Node(const Token& token);
+        Node(std::string_view tag, const std::vector<TokenAttribute>& attrs);
         Node(std::string tag, bool is_closing);
 
         bool is_closing_node(void) { return is_closing_node_; }
@@ -21,20 +25,11 @@ class Node {
         std::string tag(void) const;
         std::string attribute(const std::string& key) const;
 
-        std::weak_ptr<Node> parent(void) const;
-        void set_parent(std::shared_ptr<Node> node);
-
-        void add_child(std::shared_ptr<Node> node);
-        std::weak_ptr<const Node> child(std::string childtag) const;
-
     private:
         std::string tag_;
-        std::map<std::string, std::string> attributes_;
+        FlatMap<std::string, std::string> attributes_;
         bool is_closing_node_;
         bool is_valid_;
-
-        std::list<std::shared_ptr<Node>> children_;
-        mutable std::weak_ptr<Node> parent_;
 };
 
 }
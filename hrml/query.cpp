@@ -0,0 +1,344 @@
+#include "query.h"
+#include "tag_index.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace HRML {
+
+namespace {
+
+bool
+is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' ||
+           c == '\v' || c == '\f' || c == '\r';
+}
+
+}
+
+
+QueryPlan
+compile_query(std::string_view query, const SymbolTable& symbols)
+{
+    QueryPlan plan;
+    std::size_t start = 0;
+    std::size_t i = 0;
+
+    QueryStep::Kind kind = QueryStep::descend;
+
+    while (i < query.size()) {
+        char c = query[i++];
+        if (c != '.' && c != '~')
+            continue;
+
+        std::string_view name = query.substr(start, i - 1 - start);
+        bool between_names = !plan.steps.empty() &&
+                             kind == QueryStep::descend &&
+                             i < query.size() && query[i] != '.' &&
+                             query[i] != '~';
+        if (name.empty() && c == '.' && between_names) {
+            // `a..c`: the next step looks at every depth
+            kind = QueryStep::descendant;
+            plan.pattern = true;
+            start = i;
+            continue;
+        }
+        if (name == "*") {
+            plan.steps.push_back({kind, any_tag});
+            plan.pattern = true;
+        } else {
+            plan.steps.push_back({kind, symbols.find(name)});
+        }
+        kind = QueryStep::descend;
+
+        if (c == '~') {
+            // Attribute name is read like `istream >> std::string`
+            while (i < query.size() && is_space(query[i]))
+                ++i;
+            std::size_t word = i;
+            while (i < query.size() && !is_space(query[i]))
+                ++i;
+            plan.steps.push_back({QueryStep::attribute,
+                                  symbols.find(query.substr(word,
+                                                            i - word))});
+        }
+        start = i;
+    }
+
+    std::uint64_t hash = Tree::root_path;
+    for (const auto& step : plan.steps) {
+        if (step.kind != QueryStep::descend || step.symbol == any_tag)
+            break;
+        if (step.symbol == no_symbol)
+            return plan;
+        hash = Tree::path_hash(hash, step.symbol);
+    }
+    plan.path_hash = hash;
+    return plan;
+}
+
+
+namespace {
+
+/* Number of exact descend steps before any other kind of step */
+std::size_t
+path_length(const QueryPlan& plan)
+{
+    std::size_t n = 0;
+    while (n < plan.steps.size() &&
+           plan.steps[n].kind == QueryStep::descend &&
+           plan.steps[n].symbol != any_tag)
+        ++n;
+    return n;
+}
+
+
+/*
+ * Node reached by the first `length` descend steps of plan, looked up in
+ * the tree's path index.
+ */
+NodeRef
+find_path(const QueryPlan& plan, std::size_t length, const Tree& tree)
+{
+    if (plan.path_hash == Tree::no_path)
+        return NodeRef();
+    return tree.path(plan.path_hash, [&](NodeIndex node) {
+        for (std::size_t i = length; i-- > 0; ) {
+            const Tree::Element& element = tree.element(node);
+            if (element.tag != plan.steps[i].symbol)
+                return false;
+            node = element.parent;
+        }
+        return node == no_node;
+    });
+}
+
+
+bool
+is_pattern_step(const QueryStep& step)
+{
+    return step.kind == QueryStep::descendant ||
+           (step.kind == QueryStep::descend && step.symbol == any_tag);
+}
+
+
+/*
+ * Run the pattern part of plan, from step `first` on. Every step maps a
+ * set of nodes in document order to the next one; the set starts out as
+ * just anchor, or as the document itself when anchor is null.
+ */
+const std::string_view*
+run_pattern(const QueryPlan& plan, std::size_t first, NodeRef anchor,
+            const Tree& tree)
+{
+    const TagIndex& index = tree.tag_index();
+    const std::string_view* value = nullptr;
+
+    std::vector<NodeIndex> set, next;
+    bool top = !anchor;
+    if (!top)
+        set.push_back(anchor.index());
+
+    for (std::size_t i = first; i < plan.steps.size(); i++) {
+        const QueryStep& step = plan.steps[i];
+        if (step.kind == QueryStep::attribute) {
+            value = nullptr;
+            if (step.symbol == no_symbol)
+                continue;
+            for (NodeIndex node : set) {
+                const std::string_view* v = tree.attribute(node, step.symbol);
+                if (v != nullptr && !v->empty()) {
+                    value = v;
+                    break;
+                }
+            }
+            continue;
+        }
+
+        next.clear();
+        if (step.symbol == no_symbol) {
+            // Nothing below can match
+        } else if (step.kind == QueryStep::descendant) {
+            index.descendants(top ? nullptr : &set, step.symbol, next);
+        } else {
+            auto add = [&](NodeIndex node) {
+                if (step.symbol == any_tag ||
+                    tree.element(node).tag == step.symbol)
+                    next.push_back(node);
+            };
+            if (top)
+                std::for_each(tree.roots().begin(), tree.roots().end(), add);
+            for (NodeIndex node : set)
+                for (NodeIndex c = tree.element(node).first_child;
+                     c != no_node; c = tree.element(c).next_sibling)
+                    add(c);
+            // Children of nested nodes interleave
+            std::sort(next.begin(), next.end(), [&](auto a, auto b) {
+                return index.rank(a) < index.rank(b);
+            });
+        }
+        set.swap(next);
+        top = false;
+        if (set.empty())
+            return nullptr;
+    }
+    return value;
+}
+
+
+/*
+ * Run plan from step `first`, standing on node (or at the roots when
+ * root_search is set).
+ */
+const std::string_view*
+run_steps(const QueryPlan& plan, std::size_t first, NodeRef node,
+          bool root_search, const Tree& tree, std::uint64_t* steps)
+{
+    const std::string_view* value = nullptr;
+
+    for (std::size_t i = first; i < plan.steps.size(); i++) {
+        const QueryStep& step = plan.steps[i];
+        if (is_pattern_step(step))
+            return run_pattern(plan, i, root_search ? NodeRef() : node, tree);
+        if (step.kind == QueryStep::descend) {
+            if (step.symbol == no_symbol)
+                return nullptr;
+            if (root_search)
+                node = tree.root(step.symbol);
+            else if (steps != nullptr)
+                node = tree.child(node.index(), step.symbol, *steps);
+            else
+                node = tree.child(node.index(), step.symbol);
+            root_search = false;
+            if (!node)
+                return nullptr;
+        } else {
+            value = step.symbol != no_symbol
+                ? tree.attribute(node.index(), step.symbol) : nullptr;
+        }
+    }
+    return value != nullptr && !value->empty() ? value : nullptr;
+}
+
+}
+
+
+const std::string_view*
+run_query(const QueryPlan& plan, const Tree& tree, std::uint64_t* steps)
+{
+    std::size_t length = path_length(plan);
+    if (!tree.path_index() || length == 0)
+        return run_steps(plan, 0, NodeRef(), true, tree, steps);
+
+    NodeRef node = find_path(plan, length, tree);
+    return node ? run_steps(plan, length, node, false, tree, steps) : nullptr;
+}
+
+
+std::vector<const std::string_view*>
+run_queries(const std::vector<const QueryPlan*>& plans, const Tree& tree,
+            std::uint64_t* steps)
+{
+    return run_queries(plans.data(), plans.size(), tree, steps);
+}
+
+
+std::vector<const std::string_view*>
+run_queries(const QueryPlan* const* plans, std::size_t count,
+            const Tree& tree, std::uint64_t* steps)
+{
+    std::vector<const std::string_view*> answers(count, nullptr);
+
+    // Cached plans are shared, so repeated queries are answered once
+    std::unordered_map<const QueryPlan*, std::uint32_t> slot_of;
+    std::vector<const QueryPlan*> distinct;
+    std::vector<std::uint32_t> slots(count);
+    slot_of.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        auto ins = slot_of.emplace(plans[i],
+                                   static_cast<std::uint32_t>(distinct.size()));
+        if (ins.second)
+            distinct.push_back(plans[i]);
+        slots[i] = ins.first->second;
+    }
+
+    std::vector<const std::string_view*> results(distinct.size(), nullptr);
+    if (tree.path_index()) {
+        // Every path is one lookup, nothing to share
+        for (std::size_t i = 0; i < distinct.size(); i++)
+            results[i] = run_query(*distinct[i], tree, steps);
+        for (std::size_t i = 0; i < count; i++)
+            answers[i] = results[slots[i]];
+        return answers;
+    }
+
+    std::vector<std::size_t> lengths(distinct.size());
+    std::vector<std::uint32_t> order(distinct.size());
+    for (std::size_t i = 0; i < distinct.size(); i++) {
+        lengths[i] = path_length(*distinct[i]);
+        order[i] = static_cast<std::uint32_t>(i);
+    }
+
+    // Sorting by path puts queries sharing a prefix next to each other
+    std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+        const auto& x = distinct[a]->steps;
+        const auto& y = distinct[b]->steps;
+        std::size_t n = std::min(lengths[a], lengths[b]);
+        for (std::size_t i = 0; i < n; i++)
+            if (x[i].symbol != y[i].symbol)
+                return x[i].symbol < y[i].symbol;
+        return lengths[a] < lengths[b];
+    });
+
+    /*
+     * path[k] is the node reached by the first k + 1 descend steps of the
+     * previous query, for as many levels as resolved.
+     */
+    std::vector<NodeIndex> path;
+    const QueryPlan* prev = nullptr;
+
+    for (auto i : order) {
+        const QueryPlan& plan = *distinct[i];
+        std::size_t length = lengths[i];
+
+        std::size_t keep = 0;
+        if (prev != nullptr) {
+            std::size_t n = std::min(length, path.size());
+            while (keep < n &&
+                   prev->steps[keep].symbol == plan.steps[keep].symbol)
+                ++keep;
+        }
+        path.resize(keep);
+        prev = &plan;
+
+        while (path.size() < length) {
+            Symbol symbol = plan.steps[path.size()].symbol;
+            if (symbol == no_symbol)
+                break;
+            NodeRef node;
+            if (path.empty())
+                node = tree.root(symbol);
+            else if (steps != nullptr)
+                node = tree.child(path.back(), symbol, *steps);
+            else
+                node = tree.child(path.back(), symbol);
+            if (!node)
+                break;
+            path.push_back(node.index());
+        }
+        if (path.size() < length)
+            continue;
+
+        results[i] = length == 0
+            ? run_steps(plan, 0, NodeRef(), true, tree, steps)
+            : run_steps(plan, length, NodeRef(&tree, path.back()), false,
+                        tree, steps);
+    }
+
+    for (std::size_t i = 0; i < count; i++)
+        answers[i] = results[slots[i]];
+    return answers;
+}
+
+}
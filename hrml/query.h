@@ -0,0 +1,78 @@
+#ifndef QUERY_HPP_
+#define QUERY_HPP_
+
+#include "symbols.h"
+#include "tree.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace HRML {
+
+/* Tag of a `*` step, matches any tag */
+inline constexpr Symbol any_tag = no_symbol - 1;
+
+
+struct QueryStep {
+    enum Kind: std::uint8_t { descend, attribute, descendant };
+
+    Kind kind;
+    Symbol symbol;  // no_symbol: the name is not in the document
+};
+
+
+/*
+ * Query "tag1.tag2~attr" compiled against a document's symbol table.
+ * Each '.' or '~' closes a descend step (the first one from the roots)
+ * and '~' is followed by an attribute step naming the next
+ * whitespace-delimited word. A plan only stays valid while no new names
+ * are interned in the table.
+ *
+ * Two more step kinds make a pattern. `*` stands for any tag, and an
+ * empty step between two names (`a..c`) turns the next one into a
+ * descendant step, which matches at any depth below. Any other empty
+ * step (`.a`, `a..~v`) names no tag and finds nothing. The leading exact steps resolve as usual,
+ * each taking the first node with its tag. From the first pattern step
+ * on, a step maps every node matched so far to all of its matching
+ * children or descendants. The answer comes from the first match in
+ * document order.
+ *
+ * path_hash is the Tree::path_hash() of the leading descend steps, or
+ * Tree::no_path when one of them names an unknown tag.
+ */
+struct QueryPlan {
+    std::vector<QueryStep> steps;
+    std::uint64_t path_hash = Tree::no_path;
+    bool pattern = false;
+};
+
+
+QueryPlan compile_query(std::string_view query, const SymbolTable& symbols);
+
+/*
+ * Value the query selects, nullptr when a step finds nothing or the
+ * value is empty (both answered "Not Found!"). Unless steps is null, the
+ * child table slots and children looked at by exact descend steps are
+ * added to it, for statistics.
+ */
+const std::string_view* run_query(const QueryPlan& plan, const Tree& tree,
+                                  std::uint64_t* steps = nullptr);
+
+/*
+ * run_query() over a batch, answers come back in the order of plans.
+ * Queries are visited sorted by their leading descend steps, so a path
+ * prefix shared by several queries is resolved against the tree once.
+ * On a tree with a path index each path is a single lookup instead.
+ */
+std::vector<const std::string_view*> run_queries(
+        const std::vector<const QueryPlan*>& plans, const Tree& tree,
+        std::uint64_t* steps = nullptr);
+std::vector<const std::string_view*> run_queries(
+        const QueryPlan* const* plans, std::size_t count, const Tree& tree,
+        std::uint64_t* steps = nullptr);
+
+}
+#endif
@@ -0,0 +1,98 @@
+#include "query_cache.h"
+
+namespace HRML {
+
+QueryCache::QueryCache(std::size_t capacity)
+    : capacity_{capacity}, hits_{0}, misses_{0}
+{
+
+}
+
+
+std::shared_ptr<const QueryPlan>
+QueryCache::plan(std::string_view query, const SymbolTable& symbols)
+{
+    Lookup lookup{query, 1, nullptr};
+    plans(&lookup, 1, symbols);
+    return lookup.plan;
+}
+
+
+void
+QueryCache::plans(Lookup* lookups, std::size_t count,
+                  const SymbolTable& symbols)
+{
+    std::vector<std::list<Entry>::iterator> found(count, lru_.end());
+    {
+        std::shared_lock<std::shared_mutex> lock{mutex_};
+        for (std::size_t i = 0; i < count; i++) {
+            auto it = index_.find(lookups[i].query);
+            if (it != index_.end()) {
+                found[i] = it->second;
+                lookups[i].plan = it->second->plan;
+            }
+        }
+    }
+
+    for (std::size_t i = 0; i < count; i++)
+        if (!lookups[i].plan)
+            lookups[i].plan = std::make_shared<const QueryPlan>(
+                    compile_query(lookups[i].query, symbols));
+
+    std::lock_guard<std::shared_mutex> lock{mutex_};
+    for (std::size_t i = 0; i < count; i++) {
+        Lookup& lookup = lookups[i];
+        if (found[i] == lru_.end()) {
+            ++misses_;
+            hits_ += lookup.uses - 1;
+            insert(lookup.query, lookup.plan);
+            continue;
+        }
+        hits_ += lookup.uses;
+        // Entries are recycled, not freed, so found[i] is still an entry
+        if (found[i]->text == lookup.query)
+            lru_.splice(lru_.begin(), lru_, found[i]);
+    }
+}
+
+
+/*
+ * Add plan for query, holding the lock. When another thread added one
+ * meanwhile, plan becomes that one.
+ */
+void
+QueryCache::insert(std::string_view query,
+                   std::shared_ptr<const QueryPlan>& plan)
+{
+    if (capacity_ == 0)
+        return;
+
+    auto it = index_.find(query);
+    if (it != index_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        plan = it->second->plan;
+        return;
+    }
+
+    if (lru_.size() == capacity_) {
+        // Recycle the least recently used entry
+        index_.erase(lru_.back().text);
+        lru_.splice(lru_.begin(), lru_, std::prev(lru_.end()));
+        lru_.front().text.assign(query);
+    } else {
+        lru_.push_front({std::string(query), {}});
+    }
+    lru_.front().plan = plan;
+    index_.emplace(lru_.front().text, lru_.begin());
+}
+
+
+void
+QueryCache::clear(void)
+{
+    std::lock_guard<std::shared_mutex> lock{mutex_};
+    index_.clear();
+    lru_.clear();
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef QUERY_CACHE_HPP_
+#define QUERY_CACHE_HPP_
+
+#include "query.h"
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace HRML {
+
+/*
+ * Bounded LRU of compiled query plans keyed by query text. Plans are
+ * compiled against the symbol table handed to plan(), so the cache has to
+ * be cleared whenever that table changes. A zero capacity compiles every
+ * query. Plans are shared, so one handed out survives its eviction.
+ *
+ * plan() and plans() can be called from several threads at once, but not
+ * alongside clear(). plans() finds hits under a shared lock, compiles the
+ * misses without one and only then takes the cache for itself, once, to
+ * move the hits up and add the new plans.
+ */
+class QueryCache {
+    public:
+        /* One text to look up, standing for `uses` lookups of it */
+        struct Lookup {
+            std::string_view query;
+            std::size_t uses;
+            std::shared_ptr<const QueryPlan> plan;  // filled in
+        };
+
+        explicit QueryCache(std::size_t capacity);
+
+        std::shared_ptr<const QueryPlan> plan(std::string_view query,
+                                              const SymbolTable& symbols);
+        /* Each lookup counts one miss at most, its other uses are hits */
+        void plans(Lookup* lookups, std::size_t count,
+                   const SymbolTable& symbols);
+        void clear(void);
+
+        std::size_t size(void) const { return lru_.size(); }
+        std::size_t capacity(void) const { return capacity_; }
+        unsigned long long hits(void) const { return hits_; }
+        unsigned long long misses(void) const { return misses_; }
+
+    private:
+        struct Entry {
+            std::string text;
+            std::shared_ptr<const QueryPlan> plan;
+        };
+
+        void insert(std::string_view query,
+                    std::shared_ptr<const QueryPlan>& plan);
+
+        std::size_t capacity_;
+        std::list<Entry> lru_;  // most recently used first
+        std::unordered_map<std::string_view,
+                           std::list<Entry>::iterator> index_;
+        unsigned long long hits_;
+        unsigned long long misses_;
+        std::shared_mutex mutex_;
+};
+
+}
+#endif
@@ -0,0 +1,132 @@
+#include "scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HRML_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace HRML {
+
+namespace {
+
+const char*
+scan_scalar(const char* first, const char* last, const DelimiterSet& set)
+{
+    for (; first != last; ++first)
+        if (set.contains(*first)) return first;
+    return last;
+}
+
+
+#ifdef HRML_SCAN_X86
+
+__attribute__((target("sse2")))
+const char*
+scan_sse2(const char* first, const char* last, const DelimiterSet& set)
+{
+    __m128i needles[DelimiterSet::max_size];
+    for (std::size_t i = 0; i < set.size(); i++)
+        needles[i] = _mm_set1_epi8(set[i]);
+
+    for (; last - first >= 16; first += 16) {
+        __m128i block = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(first));
+        __m128i hits = _mm_setzero_si128();
+        for (std::size_t i = 0; i < set.size(); i++)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[i]));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask)
+            return first + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    return scan_scalar(first, last, set);
+}
+
+
+__attribute__((target("avx2")))
+const char*
+scan_avx2(const char* first, const char* last, const DelimiterSet& set)
+{
+    __m256i needles[DelimiterSet::max_size];
+    for (std::size_t i = 0; i < set.size(); i++)
+        needles[i] = _mm256_set1_epi8(set[i]);
+
+    for (; last - first >= 32; first += 32) {
+        __m256i block = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(first));
+        __m256i hits = _mm256_setzero_si256();
+        for (std::size_t i = 0; i < set.size(); i++)
+            hits = _mm256_or_si256(hits,
+                                   _mm256_cmpeq_epi8(block, needles[i]));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return scan_scalar(first, last, set);
+}
+
+#endif
+
+
+ScanKernel
+detect_kernel(void)
+{
+#ifdef HRML_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ScanKernel::avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return ScanKernel::sse2;
+#endif
+    return ScanKernel::scalar;
+}
+
+}
+
+
+ScanKernel
+scan_kernel(void)
+{
+    static const ScanKernel kernel = detect_kernel();
+    return kernel;
+}
+
+
+bool
+scan_kernel_supported(ScanKernel kernel)
+{
+    switch (kernel) {
+        case ScanKernel::scalar:
+            return true;
+        case ScanKernel::sse2:
+            return scan_kernel() != ScanKernel::scalar;
+        case ScanKernel::avx2:
+            return scan_kernel() == ScanKernel::avx2;
+    }
+    return false;
+}
+
+
+const char*
+find_delimiter(ScanKernel kernel, const char* first, const char* last,
+               const DelimiterSet& set)
+{
+    switch (kernel) {
+#ifdef HRML_SCAN_X86
+        case ScanKernel::avx2:
+            return scan_avx2(first, last, set);
+        case ScanKernel::sse2:
+            return scan_sse2(first, last, set);
+#endif
+        default:
+            return scan_scalar(first, last, set);
+    }
+}
+
+
+const char*
+find_delimiter(const char* first, const char* last, const DelimiterSet& set)
+{
+    return find_delimiter(scan_kernel(), first, last, set);
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef SCANNER_HPP_
+#define SCANNER_HPP_
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+namespace HRML {
+
+/*
+ * Small set of delimiter bytes (at most 8) searched for by the scanner.
+ * Keeps both the byte list, used by the vector kernels, and a 256-bit
+ * membership map used by the scalar kernel.
+ */
+class DelimiterSet {
+    public:
+        static constexpr std::size_t max_size = 8;
+
+        constexpr DelimiterSet(std::string_view chars)
+            : chars_{}, size_{0}, map_{}
+        {
+            for (char c : chars) {
+                if (size_ == max_size)
+                    break;
+                auto u = static_cast<unsigned char>(c);
+                chars_[size_++] = c;
+                map_[u >> 6] |= 1ull << (u & 63);
+            }
+        }
+
+        constexpr bool contains(char c) const
+        {
+            auto u = static_cast<unsigned char>(c);
+            return (map_[u >> 6] >> (u & 63)) & 1;
+        }
+
+        constexpr std::size_t size(void) const { return size_; }
+        constexpr char operator[](std::size_t i) const { return chars_[i]; }
+
+    private:
+        std::array<char, max_size> chars_;
+        std::size_t size_;
+        std::array<unsigned long long, 4> map_;
+};
+
+
+/* Hrml structural bytes: '"', '=', ' ', '<', '>' and '/' */
+inline constexpr DelimiterSet structural_delimiters{"\"= <>/"};
+
+
+enum class ScanKernel { scalar, sse2, avx2 };
+
+/*
+ * Kernel used by find_delimiter(), the widest one the running cpu
+ * supports. Picked once, on first use.
+ */
+ScanKernel scan_kernel(void);
+bool scan_kernel_supported(ScanKernel kernel);
+
+/*
+ * Return a pointer to the first byte in [first, last) that belongs to
+ * set, or last when there is none.
+ */
+const char* find_delimiter(const char* first, const char* last,
+                           const DelimiterSet& set);
+const char* find_delimiter(ScanKernel kernel,
+                           const char* first, const char* last,
+                           const DelimiterSet& set);
+
+}
+#endif
@@ -0,0 +1,323 @@
+#include "server.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <list>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace HRML {
+
+ServerStats::ServerStats(void)
+    : queries_{0}, batches_{0}, bytes_in_{0}, bytes_out_{0},
+      busy_{0}, max_{0}, histogram_{}
+{
+
+}
+
+
+std::size_t
+ServerStats::bucket(std::uint64_t ns)
+{
+    if (ns < 4)
+        return static_cast<std::size_t>(ns);
+    unsigned e = 63 - static_cast<unsigned>(__builtin_clzll(ns));
+    return 4 * (e - 1) + ((ns >> (e - 2)) & 3);
+}
+
+
+std::uint64_t
+ServerStats::bucket_limit(std::size_t b)
+{
+    if (b < 4)
+        return b;
+    if (b == buckets - 1)
+        return UINT64_MAX;
+    unsigned e = static_cast<unsigned>(b / 4 + 1);
+    return (1ull << e) + ((b % 4 + 1ull) << (e - 2)) - 1;
+}
+
+
+void
+ServerStats::record(std::uint64_t queries, std::chrono::nanoseconds latency)
+{
+    queries_ += queries;
+    ++batches_;
+    busy_ += latency;
+    max_ = std::max(max_, latency);
+    histogram_[bucket(static_cast<std::uint64_t>(latency.count()))] += queries;
+}
+
+
+double
+ServerStats::queries_per_second(void) const
+{
+    if (busy_.count() == 0)
+        return 0;
+    return queries_ / std::chrono::duration<double>(busy_).count();
+}
+
+
+std::chrono::nanoseconds
+ServerStats::latency(double p) const
+{
+    auto target = static_cast<std::uint64_t>(std::ceil(p / 100 * queries_));
+    std::uint64_t seen = 0;
+    for (std::size_t b = 0; b < buckets; b++) {
+        seen += histogram_[b];
+        if (seen >= target && seen != 0)
+            return std::min(max_, std::chrono::nanoseconds(
+                        static_cast<std::int64_t>(std::min<std::uint64_t>(
+                            bucket_limit(b), INT64_MAX))));
+    }
+    return max_;
+}
+
+
+std::string
+ServerStats::summary(void) const
+{
+    auto us = [](std::chrono::nanoseconds ns) {
+        return std::chrono::duration<double, std::micro>(ns).count();
+    };
+    std::ostringstream out;
+    out << "queries " << queries_ << " batches " << batches_
+        << " in " << bytes_in_ << " B out " << bytes_out_ << " B"
+        << " busy " << us(busy_) << " us " << queries_per_second() << " q/s"
+        << " latency p50 " << us(latency(50)) << " us p99 "
+        << us(latency(99)) << " us max " << us(max_) << " us";
+    return out.str();
+}
+
+
+namespace {
+
+/* Closes a file descriptor on scope exit */
+class FileDescriptor {
+    public:
+        explicit FileDescriptor(int fd) : fd_{fd} {}
+        ~FileDescriptor(void) { if (fd_ >= 0) ::close(fd_); }
+
+        FileDescriptor(const FileDescriptor&) = delete;
+        FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+        int get(void) const { return fd_; }
+
+    private:
+        int fd_;
+};
+
+
+/* A peer gone away is an error, not a SIGPIPE, on sockets */
+void
+write_all(int fd, const std::string& data)
+{
+    std::size_t done = 0;
+    bool socket = true;
+    while (done < data.size()) {
+        ssize_t n = socket
+            ? ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL)
+            : ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0) {
+            if (errno == ENOTSOCK && socket) {
+                socket = false;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(),
+                                    "write");
+        }
+        done += static_cast<std::size_t>(n);
+    }
+}
+
+}
+
+
+QueryServer::QueryServer(Hrml& hrml, std::size_t max_line)
+    : hrml_{hrml}, max_line_{max_line}, stopped_{false}
+{
+    if (::pipe2(wake_, O_CLOEXEC | O_NONBLOCK) < 0)
+        throw std::system_error(errno, std::generic_category(), "pipe");
+}
+
+
+QueryServer::~QueryServer(void)
+{
+    ::close(wake_[0]);
+    ::close(wake_[1]);
+}
+
+
+void
+QueryServer::stop(void)
+{
+    stopped_.store(true);
+    char c = 0;
+    if (::write(wake_[1], &c, 1) < 0) {
+        // Full pipe, listen() is already being woken
+    }
+}
+
+
+void
+QueryServer::serve(int in_fd, int out_fd)
+{
+    std::vector<char> buf(1 << 16);
+    std::string pending;    // lines read but not answered yet
+    std::vector<std::string_view> queries;
+    std::string out;
+
+    auto answer = [&](std::size_t length,
+                      std::chrono::steady_clock::time_point start) {
+        queries.clear();
+        std::string_view lines{pending.data(), length};
+        while (!lines.empty()) {
+            auto nl = lines.find('\n');
+            queries.push_back(lines.substr(0, nl));
+            lines.remove_prefix(nl != std::string_view::npos
+                                ? nl + 1 : lines.size());
+        }
+
+        out.clear();
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            hrml_.answer_queries(queries);
+            for (const auto& value : hrml_.answers()) {
+                out.append(value);
+                out.push_back('\n');
+            }
+            hrml_.clear_answers();
+        }
+        // A slow reader only holds up its own connection
+        write_all(out_fd, out);
+
+        std::lock_guard<std::mutex> lock{mutex_};
+        stats_.record(queries.size(),
+                      std::chrono::steady_clock::now() - start);
+        stats_.add_bytes(length, out.size());
+    };
+
+    for (;;) {
+        ssize_t n = ::read(in_fd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR && !stopped())
+                continue;
+            if (errno == EINTR)
+                return;
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+        auto start = std::chrono::steady_clock::now();
+
+        if (n == 0) {
+            if (!pending.empty())
+                answer(pending.size(), start);
+            return;
+        }
+
+        pending.append(buf.data(), static_cast<std::size_t>(n));
+        auto last = pending.rfind('\n');
+        if (last != std::string::npos) {
+            answer(last + 1, start);
+            pending.erase(0, last + 1);
+        }
+        if (pending.size() > max_line_)
+            return;
+    }
+}
+
+
+void
+QueryServer::listen(const std::string& path)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    FileDescriptor sock{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+    if (sock.get() < 0)
+        throw std::system_error(errno, std::generic_category(), "socket");
+    ::unlink(path.c_str());
+    if (::bind(sock.get(), reinterpret_cast<const sockaddr*>(&addr),
+               sizeof(addr)) < 0 || ::listen(sock.get(), 16) < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    struct Connection {
+        int fd;
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+    std::list<Connection> connections;
+
+    // Join what has finished; with all set, end the rest first
+    auto reap = [&](bool all) {
+        for (auto it = connections.begin(); it != connections.end(); ) {
+            if (all)
+                ::shutdown(it->fd, SHUT_RDWR);
+            else if (!it->done.load()) {
+                ++it;
+                continue;
+            }
+            if (it->thread.joinable())
+                it->thread.join();
+            ::close(it->fd);
+            it = connections.erase(it);
+        }
+    };
+
+    try {
+        while (!stopped()) {
+            pollfd fds[2] = {{sock.get(), POLLIN, 0},
+                             {wake_[0], POLLIN, 0}};
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(),
+                                        "poll");
+            }
+            reap(false);
+            if (!(fds[0].revents & POLLIN))
+                continue;
+
+            int client = ::accept4(sock.get(), nullptr, nullptr,
+                                   SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                throw std::system_error(errno, std::generic_category(),
+                                        "accept");
+            }
+            Connection& connection = connections.emplace_back();
+            connection.fd = client;
+            connection.thread = std::thread([this, &connection] {
+                try {
+                    serve(connection.fd, connection.fd);
+                } catch (const std::system_error&) {
+                    // A client going away only ends its own connection
+                }
+                // The client sees the end now, the descriptor goes later
+                ::shutdown(connection.fd, SHUT_RDWR);
+                connection.done.store(true);
+            });
+        }
+    } catch (...) {
+        reap(true);
+        throw;
+    }
+    reap(true);
+    ::unlink(path.c_str());
+}
+
+}
@@ -0,0 +1,114 @@
+#ifndef SERVER_HPP_
+#define SERVER_HPP_
+
+#include "hrml.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace HRML {
+
+/*
+ * Counters kept by a QueryServer. A request is one query line; its
+ * latency runs from the read that completed the line to the write of its
+ * answer. Latencies go to a log-linear histogram (4 steps per power of
+ * two nanoseconds), so percentiles are exact to within 25%.
+ */
+class ServerStats {
+    public:
+        ServerStats(void);
+
+        void record(std::uint64_t queries, std::chrono::nanoseconds latency);
+        void add_bytes(std::uint64_t in, std::uint64_t out)
+        {
+            bytes_in_ += in;
+            bytes_out_ += out;
+        }
+
+        std::uint64_t queries(void) const { return queries_; }
+        std::uint64_t batches(void) const { return batches_; }
+        std::uint64_t bytes_in(void) const { return bytes_in_; }
+        std::uint64_t bytes_out(void) const { return bytes_out_; }
+        /* Time spent answering, from first read to last write */
+        std::chrono::nanoseconds busy(void) const { return busy_; }
+        double queries_per_second(void) const;
+        /* Upper bound of the bucket holding the p-th percentile (0-100) */
+        std::chrono::nanoseconds latency(double p) const;
+        std::chrono::nanoseconds max_latency(void) const { return max_; }
+
+        /* One line summary: queries, batches, throughput, latencies */
+        std::string summary(void) const;
+
+    private:
+        // 0-3 alone, then four per power of two up to 2^63 and beyond
+        static constexpr std::size_t buckets = 63 * 4;
+        static std::size_t bucket(std::uint64_t ns);
+        static std::uint64_t bucket_limit(std::size_t b);
+
+        std::uint64_t queries_;
+        std::uint64_t batches_;
+        std::uint64_t bytes_in_;
+        std::uint64_t bytes_out_;
+        std::chrono::nanoseconds busy_;
+        std::chrono::nanoseconds max_;
+        std::array<std::uint64_t, buckets> histogram_;
+};
+
+
+/*
+ * Answers a stream of query lines against an already loaded document.
+ * Each read takes whatever the client has sent. All complete lines in it
+ * are answered as one batch and their answers go back in a single write,
+ * in order. So a client can pipeline any number of queries without
+ * waiting for answers. A last line without '\n' is answered at end of
+ * input. Lines are not validated: one without '~' is answered
+ * "Not Found!". A line longer than max_line bytes ends the stream, so a
+ * client that never sends '\n' can not make the server buffer without
+ * bound.
+ *
+ * Several streams can be served at once: batches are answered one at a
+ * time, but reads and writes overlap.
+ */
+class QueryServer {
+    public:
+        explicit QueryServer(Hrml& hrml, std::size_t max_line = 1 << 20);
+        ~QueryServer(void);
+
+        QueryServer(const QueryServer&) = delete;
+        QueryServer& operator=(const QueryServer&) = delete;
+
+        /* Serve queries from in_fd, answers to out_fd, until end of input */
+        void serve(int in_fd, int out_fd);
+
+        /*
+         * Listen on a Unix domain socket at path, replacing any file
+         * there, and serve every connection on its own thread until
+         * stop(). Open connections are then shut down and waited for.
+         * Throws std::system_error when the socket can not be set up.
+         */
+        void listen(const std::string& path);
+
+        /* Safe from a signal handler and from other threads */
+        void stop(void);
+        bool stopped(void) const { return stopped_.load(); }
+
+        /* Read it once serving is over */
+        const ServerStats& stats(void) const { return stats_; }
+
+    private:
+        Hrml& hrml_;
+        std::size_t max_line_;
+        /* Guards hrml_ and stats_ */
+        std::mutex mutex_;
+        ServerStats stats_;
+        std::atomic<bool> stopped_;
+        /* stop() writes to wake_[1] to wake listen() */
+        int wake_[2];
+};
+
+}
+#endif
@@ -0,0 +1,218 @@
+#include "snapshot.h"
+#include "hrml.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace HRML {
+
+static_assert(sizeof(SnapshotHeader) == 48);
+static_assert(sizeof(SnapshotString) == 8);
+static_assert(sizeof(SnapshotNode) == 16);
+static_assert(sizeof(MappedAttribute) == 12);
+
+namespace {
+
+/* Appends strings to the pool, each distinct value once */
+class StringPool {
+    public:
+        std::uint32_t add(std::string_view s, bool shared)
+        {
+            if (shared) {
+                auto it = offsets_.find(s);
+                if (it != offsets_.end())
+                    return it->second;
+            }
+            if (pool_.size() + s.size() > UINT32_MAX)
+                throw HrmlFail("snapshot string pool over 4 GiB");
+            auto offset = static_cast<std::uint32_t>(pool_.size());
+            pool_.append(s);
+            if (shared)
+                offsets_.emplace(s, offset);
+            return offset;
+        }
+
+        const std::string& data(void) const { return pool_; }
+
+    private:
+        std::string pool_;
+        std::unordered_map<std::string_view, std::uint32_t> offsets_;
+};
+
+
+template <class T>
+void
+write_table(std::ostream& out, const std::vector<T>& table)
+{
+    out.write(reinterpret_cast<const char*>(table.data()),
+              static_cast<std::streamsize>(table.size() * sizeof(T)));
+}
+
+
+std::uint64_t
+image_size(const SnapshotHeader& header)
+{
+    return sizeof(SnapshotHeader) +
+           std::uint64_t{header.symbols} * sizeof(SnapshotString) +
+           std::uint64_t{header.nodes} * sizeof(SnapshotNode) +
+           std::uint64_t{header.attributes} * sizeof(MappedAttribute) +
+           header.pool_size;
+}
+
+
+bool
+in_pool(std::uint64_t offset, std::uint64_t size, std::uint64_t pool_size)
+{
+    return offset <= pool_size && size <= pool_size - offset;
+}
+
+}
+
+
+void
+write_snapshot(const Tree& tree, std::ostream& out)
+{
+    const SymbolTable& symbols = tree.symbols();
+    StringPool pool;
+
+    std::vector<SnapshotString> names;
+    names.reserve(symbols.size());
+    for (Symbol s = 0; s < symbols.size(); s++) {
+        std::string_view name = symbols.name(s);
+        names.push_back({pool.add(name, false),
+                         static_cast<std::uint32_t>(name.size())});
+    }
+
+    // Preorder over the linked nodes, renumbered densely
+    std::vector<NodeIndex> renumber(tree.size(), no_node);
+    std::vector<SnapshotNode> nodes;
+    std::vector<MappedAttribute> attributes;
+    std::vector<NodeIndex> work;
+    for (NodeIndex root : tree.roots()) {
+        work.push_back(root);
+        while (!work.empty()) {
+            NodeIndex node = work.back();
+            work.pop_back();
+            const Tree::Element& element = tree.element(node);
+            renumber[node] = static_cast<NodeIndex>(nodes.size());
+
+            SnapshotNode entry{element.tag,
+                               element.parent == no_node
+                                   ? no_node : renumber[element.parent],
+                               static_cast<std::uint32_t>(attributes.size()),
+                               0};
+            Tree::AttributeSpan span = tree.attributes(node);
+            for (std::uint32_t i = 0; i < span.size; i++)
+                attributes.push_back({span.keys[i],
+                                      pool.add(span.values[i], true),
+                                      static_cast<std::uint32_t>(
+                                          span.values[i].size())});
+            entry.attribute_count = span.size;
+            nodes.push_back(entry);
+
+            std::size_t mark = work.size();
+            for (NodeIndex child = element.first_child; child != no_node;
+                 child = tree.element(child).next_sibling)
+                work.push_back(child);
+            std::reverse(work.begin() + mark, work.end());
+        }
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.endian_mark = snapshot_endian_mark;
+    header.symbols = static_cast<std::uint32_t>(names.size());
+    header.nodes = static_cast<std::uint32_t>(nodes.size());
+    header.attributes = static_cast<std::uint32_t>(attributes.size());
+    header.pool_size = pool.data().size();
+    header.file_size = image_size(header);
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_table(out, names);
+    write_table(out, nodes);
+    write_table(out, attributes);
+    out.write(pool.data().data(),
+              static_cast<std::streamsize>(pool.data().size()));
+    if (!out)
+        throw HrmlFail("snapshot write failed");
+}
+
+
+std::uint32_t
+read_snapshot(std::string_view image, Tree& tree)
+{
+    if (image.size() < sizeof(SnapshotHeader))
+        throw HrmlSnapshotError("snapshot truncated");
+    if (reinterpret_cast<std::uintptr_t>(image.data()) %
+            alignof(SnapshotNode) != 0)
+        throw HrmlSnapshotError("snapshot image misaligned");
+
+    SnapshotHeader header;
+    std::memcpy(&header, image.data(), sizeof(header));
+    if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0)
+        throw HrmlSnapshotError("not a snapshot");
+    if (header.endian_mark != snapshot_endian_mark)
+        throw HrmlSnapshotError("snapshot written with another byte order");
+    if (header.version != snapshot_version)
+        throw HrmlSnapshotError("snapshot version " +
+                                std::to_string(header.version) +
+                                ", expected " +
+                                std::to_string(snapshot_version));
+    if (header.pool_size > UINT32_MAX ||
+        header.file_size != image_size(header))
+        throw HrmlSnapshotError("snapshot header inconsistent");
+    if (image.size() < header.file_size)
+        throw HrmlSnapshotError("snapshot truncated");
+    if (image.size() > header.file_size)
+        throw HrmlSnapshotError("snapshot has trailing bytes");
+
+    const char* at = image.data() + sizeof(header);
+    auto* names = reinterpret_cast<const SnapshotString*>(at);
+    at += std::size_t{header.symbols} * sizeof(SnapshotString);
+    auto* nodes = reinterpret_cast<const SnapshotNode*>(at);
+    at += std::size_t{header.nodes} * sizeof(SnapshotNode);
+    auto* attributes = reinterpret_cast<const MappedAttribute*>(at);
+    at += std::size_t{header.attributes} * sizeof(MappedAttribute);
+    std::string_view pool{at, static_cast<std::size_t>(header.pool_size)};
+
+    // Tables are checked before the tree is touched
+    for (std::uint32_t i = 0; i < header.symbols; i++)
+        if (!in_pool(names[i].offset, names[i].size, header.pool_size))
+            throw HrmlSnapshotError("snapshot name out of bounds");
+    for (std::uint32_t i = 0; i < header.attributes; i++) {
+        const MappedAttribute& attr = attributes[i];
+        if (attr.key >= header.symbols ||
+            !in_pool(attr.value_offset, attr.value_size, header.pool_size))
+            throw HrmlSnapshotError("snapshot attribute out of bounds");
+    }
+    for (std::uint32_t i = 0; i < header.nodes; i++) {
+        const SnapshotNode& node = nodes[i];
+        if (node.tag >= header.symbols ||
+            (node.parent != no_node && node.parent >= i) ||
+            std::uint64_t{node.first_attribute} + node.attribute_count >
+                header.attributes)
+            throw HrmlSnapshotError("snapshot node " + std::to_string(i) +
+                                    " out of bounds");
+    }
+
+    SymbolTable& symbols = tree.symbols();
+    for (Symbol s = 0; s < header.symbols; s++) {
+        if (symbols.intern(pool.substr(names[s].offset, names[s].size)) != s)
+            throw HrmlSnapshotError("snapshot names repeat");
+    }
+
+    tree.reserve(header.nodes);
+    tree.map_strings(pool);
+    for (std::uint32_t i = 0; i < header.nodes; i++)
+        tree.add_mapped(nodes[i].parent, nodes[i].tag,
+                        attributes + nodes[i].first_attribute,
+                        nodes[i].attribute_count);
+    tree.build_child_indexes();
+    return header.nodes;
+}
+
+}
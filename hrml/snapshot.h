@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_HPP_
+#define SNAPSHOT_HPP_
+
+#include "tree.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+namespace HRML {
+
+/*
+ * Binary image of a Tree, read in place from a mapping. Offsets and
+ * indexes replace pointers, so the image works at any address:
+ *
+ *     SnapshotHeader
+ *     SnapshotString[symbols]     names, in Symbol order
+ *     SnapshotNode[nodes]         preorder, parents come first
+ *     MappedAttribute[attributes] grouped by node
+ *     char[pool_size]             names and values, values stored once
+ *
+ * A node's children are the nodes naming it as parent, in table order.
+ * Every table starts on a 4 byte boundary. Numbers are in the byte order
+ * of the writer, checked through endian_mark.
+ */
+inline constexpr char snapshot_magic[8] = {'H', 'R', 'M', 'L',
+                                           'S', 'N', 'A', 'P'};
+inline constexpr std::uint32_t snapshot_version = 1;
+inline constexpr std::uint32_t snapshot_endian_mark = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t endian_mark;
+    std::uint32_t symbols;
+    std::uint32_t nodes;
+    std::uint32_t attributes;
+    std::uint32_t reserved;
+    std::uint64_t pool_size;
+    /* Whole file, a shorter one was cut off */
+    std::uint64_t file_size;
+};
+
+struct SnapshotString {
+    std::uint32_t offset;
+    std::uint32_t size;
+};
+
+struct SnapshotNode {
+    Symbol tag;
+    NodeIndex parent;
+    std::uint32_t first_attribute;
+    std::uint32_t attribute_count;
+};
+
+
+/* Write the nodes still linked into tree, throws HrmlFail */
+void write_snapshot(const Tree& tree, std::ostream& out);
+
+/*
+ * Check image and add its nodes to tree, which has to be empty. The
+ * nodes keep pointing into image for their attributes. Returns the
+ * number of nodes, throws HrmlSnapshotError for a bad image; tree may
+ * then hold part of it. Nothing is parsed, but every node is still added
+ * and the child tables built, so this is O(nodes).
+ */
+std::uint32_t read_snapshot(std::string_view image, Tree& tree);
+
+}
+#endif
@@ -0,0 +1,70 @@
+#ifndef STRING_ARENA_HPP_
+#define STRING_ARENA_HPP_
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace HRML {
+
+/*
+ * Append-only store for text. Strings are copied into large blocks that
+ * are never moved or freed before clear(), so the views add() returns
+ * stay valid however much is added after them. Strings too long to share
+ * a block get one of their own.
+ */
+class StringArena {
+    public:
+        std::string_view add(std::string_view s)
+        {
+            if (s.empty())
+                return std::string_view();
+
+            char* at;
+            if (s.size() > block_size / 4) {
+                at = allocate(s.size());
+            } else {
+                if (s.size() > left_) {
+                    free_ = allocate(block_size);
+                    left_ = block_size;
+                }
+                at = free_;
+                free_ += s.size();
+                left_ -= s.size();
+            }
+            std::memcpy(at, s.data(), s.size());
+            return std::string_view(at, s.size());
+        }
+
+        /* Heap bytes held */
+        std::size_t bytes(void) const { return bytes_; }
+
+        void clear(void)
+        {
+            blocks_.clear();
+            blocks_.shrink_to_fit();
+            free_ = nullptr;
+            left_ = 0;
+            bytes_ = 0;
+        }
+
+    private:
+        static constexpr std::size_t block_size = 1 << 16;
+
+        char* allocate(std::size_t size)
+        {
+            blocks_.emplace_back(new char[size]);
+            bytes_ += size;
+            return blocks_.back().get();
+        }
+
+        std::vector<std::unique_ptr<char[]>> blocks_;
+        char* free_ = nullptr;
+        std::size_t left_ = 0;
+        std::size_t bytes_ = 0;
+};
+
+}
+#endif
@@ -0,0 +1,34 @@
+#include "symbols.h"
+
+namespace HRML {
+
+Symbol
+SymbolTable::intern(std::string_view name)
+{
+    auto it = index_.find(name);
+    if (it != index_.end())
+        return it->second;
+
+    auto symbol = static_cast<Symbol>(names_.size());
+    names_.emplace_back(name);
+    index_.emplace(names_.back(), symbol);
+    return symbol;
+}
+
+
+Symbol
+SymbolTable::find(std::string_view name) const
+{
+    auto it = index_.find(name);
+    return it != index_.end() ? it->second : no_symbol;
+}
+
+
+void
+SymbolTable::clear(void)
+{
+    index_.clear();
+    names_.clear();
+}
+
+}
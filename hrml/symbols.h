@@ -0,0 +1,40 @@
+#ifndef SYMBOLS_HPP_
+#define SYMBOLS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace HRML {
+
+using Symbol = std::uint32_t;
+inline constexpr Symbol no_symbol = UINT32_MAX;
+
+
+/*
+ * Document level string interner for tag and attribute names. Every
+ * distinct name is stored once and gets a small dense id, so names can be
+ * compared as integers. Names never move, views returned by name() stay
+ * valid until the table is cleared.
+ */
+class SymbolTable {
+    public:
+        Symbol intern(std::string_view name);
+
+        /* no_symbol when name was never interned */
+        Symbol find(std::string_view name) const;
+
+        std::string_view name(Symbol symbol) const { return names_[symbol]; }
+        std::size_t size(void) const { return names_.size(); }
+        void clear(void);
+
+    private:
+        std::deque<std::string> names_;
+        std::unordered_map<std::string_view, Symbol> index_;
+};
+
+}
+#endif
@@ -0,0 +1,220 @@
+#include "tag_index.h"
+#include "query.h"
+#include "tree.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace HRML {
+
+TagIndex::TagIndex(const Tree& tree)
+    : tree_{tree}, rank_(tree.size(), 0), end_(tree.size(), 0),
+      postings_(tree.symbols().size())
+{
+    // Evenly spaced, with room for as many nodes again
+    const std::uint64_t step = top / (4 * tree.size() + 1);
+    std::uint64_t label = 0;
+    for (Event e = next(Event{no_node, false}); e.node != no_node;
+         e = next(e)) {
+        set_label(e, label += step);
+        if (!e.leave)
+            postings_[tree.element(e.node).tag].push_back(e.node);
+    }
+}
+
+
+std::uint64_t
+TagIndex::label(Event e) const
+{
+    if (e.node == no_node)
+        return e.leave ? top : 0;
+    return e.leave ? end_[e.node] : rank_[e.node];
+}
+
+
+void
+TagIndex::set_label(Event e, std::uint64_t label)
+{
+    (e.leave ? end_ : rank_)[e.node] = label;
+}
+
+
+/* Next event of the walk; leaving the document is the last one */
+TagIndex::Event
+TagIndex::next(Event e) const
+{
+    if (e.node == no_node) {
+        const auto& roots = tree_.roots();
+        return e.leave || roots.empty() ? Event{no_node, true}
+                                        : Event{roots.front(), false};
+    }
+    const Tree::Element& element = tree_.element(e.node);
+    if (!e.leave)
+        return element.first_child != no_node
+            ? Event{element.first_child, false} : Event{e.node, true};
+    if (element.next_sibling != no_node)
+        return Event{element.next_sibling, false};
+    return Event{element.parent, true};
+}
+
+
+/* Previous event of the walk; entering the document is the first one */
+TagIndex::Event
+TagIndex::prev(Event e) const
+{
+    if (e.node == no_node) {
+        const auto& roots = tree_.roots();
+        return !e.leave || roots.empty() ? Event{no_node, false}
+                                         : Event{roots.back(), true};
+    }
+    const Tree::Element& element = tree_.element(e.node);
+    if (e.leave)
+        return element.last_child != no_node
+            ? Event{element.last_child, true} : Event{e.node, false};
+    if (element.prev_sibling != no_node)
+        return Event{element.prev_sibling, true};
+    return Event{element.parent, false};
+}
+
+
+void
+TagIndex::insert(NodeIndex node)
+{
+    if (rank_.size() <= node) {
+        rank_.resize(node + 1, 0);
+        end_.resize(node + 1, 0);
+    }
+
+    Event before = prev(Event{node, false});
+    std::uint64_t a = label(before);
+    std::uint64_t b = label(next(Event{node, true}));
+    if (b - a > 2) {
+        // A third of the gap on either side, for children and siblings
+        rank_[node] = a + (b - a) / 3;
+        end_[node] = a + (b - a) / 3 * 2;
+    } else {
+        spread(before, node);
+    }
+
+    Symbol tag = tree_.element(node).tag;
+    if (postings_.size() <= tag)
+        postings_.resize(tag + 1);
+    auto& list = postings_[tag];
+    list.insert(std::upper_bound(list.begin(), list.end(), rank_[node],
+                                 [&](std::uint64_t r, NodeIndex n) {
+        return r < rank_[n];
+    }), node);
+}
+
+
+/*
+ * Label node, whose events come right after before, by spreading out
+ * the labels around it: the range is the smallest aligned one holding
+ * before's label in which fewer than 1.6^bits events would be, 1.6
+ * keeping the density thresholds apart enough for the amortized bound.
+ */
+void
+TagIndex::spread(Event before, NodeIndex node)
+{
+    const std::uint64_t at = label(before);
+    std::vector<Event> events;
+    for (unsigned bits = 1;; bits++) {
+        std::uint64_t lo = bits < 62 ? at >> bits << bits : 0;
+        std::uint64_t hi = bits < 62 ? lo + (std::uint64_t{1} << bits) : top;
+
+        events.clear();
+        for (Event e = before; e.node != no_node && label(e) >= lo;
+             e = prev(e))
+            events.push_back(e);
+        std::reverse(events.begin(), events.end());
+        events.push_back(Event{node, false});
+        events.push_back(Event{node, true});
+        for (Event e = next(Event{node, true});
+             e.node != no_node && label(e) < hi; e = next(e))
+            events.push_back(e);
+
+        if (bits < 62 && events.size() >= std::pow(1.6, bits))
+            continue;
+        std::uint64_t step = (hi - lo) / (events.size() + 1);
+        for (std::size_t i = 0; i < events.size(); i++)
+            set_label(events[i], lo + (i + 1) * step);
+        return;
+    }
+}
+
+
+void
+TagIndex::erase(NodeIndex node)
+{
+    std::vector<NodeIndex> nodes{node};
+    walk(Event{node, false}, Event{node, true}, nodes);
+    std::vector<Symbol> tags;
+    for (NodeIndex n : nodes)
+        tags.push_back(tree_.element(n).tag);
+    std::sort(tags.begin(), tags.end());
+    tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+
+    // A subtree is one label range, so one stretch of each postings list
+    auto by_rank = [&](NodeIndex n, std::uint64_t r) { return rank_[n] < r; };
+    for (Symbol tag : tags) {
+        auto& list = postings_[tag];
+        auto first = std::lower_bound(list.begin(), list.end(), rank_[node],
+                                      by_rank);
+        auto last = std::lower_bound(first, list.end(), end_[node], by_rank);
+        list.erase(first, last);
+    }
+}
+
+
+/* Nodes entered strictly between first and last, in walk order */
+void
+TagIndex::walk(Event first, Event last, std::vector<NodeIndex>& out) const
+{
+    for (Event e = next(first); e.node != last.node || e.leave != last.leave;
+         e = next(e))
+        if (!e.leave) out.push_back(e.node);
+}
+
+
+void
+TagIndex::collect(std::uint64_t after, std::uint64_t before, Symbol tag,
+                  std::vector<NodeIndex>& out) const
+{
+    if (tag >= postings_.size())
+        return;
+    const auto& list = postings_[tag];
+    auto it = std::upper_bound(list.begin(), list.end(), after,
+                               [&](std::uint64_t r, NodeIndex n) {
+        return r < rank_[n];
+    });
+    for (; it != list.end() && rank_[*it] < before; ++it)
+        out.push_back(*it);
+}
+
+
+void
+TagIndex::descendants(const std::vector<NodeIndex>* from, Symbol tag,
+                      std::vector<NodeIndex>& out) const
+{
+    if (from == nullptr) {
+        if (tag == any_tag)
+            walk(Event{no_node, false}, Event{no_node, true}, out);
+        else
+            collect(0, top, tag, out);
+        return;
+    }
+
+    // Nodes inside an earlier node's range add nothing new
+    std::uint64_t covered = 0;
+    for (NodeIndex node : *from) {
+        if (rank_[node] < covered)
+            continue;
+        if (tag == any_tag)
+            walk(Event{node, false}, Event{node, true}, out);
+        else
+            collect(rank_[node], end_[node], tag, out);
+        covered = end_[node];
+    }
+}
+
+}
@@ -0,0 +1,82 @@
+#ifndef TAG_INDEX_HPP_
+#define TAG_INDEX_HPP_
+
+#include "symbols.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace HRML {
+
+class Tree;
+using NodeIndex = std::uint32_t;
+
+
+/*
+ * Document order labels of a tree plus, for every tag, the nodes
+ * carrying it in document order (its postings list). A depth first walk
+ * enters and leaves every node; both events get a 64-bit label and the
+ * labels grow along the walk, so a node's subtree is the label range
+ * (rank, end) and ancestor checks are two compares. Descendants with a
+ * tag, below a set of nodes, come out of one pass over that tag's
+ * postings, skipping ahead by bisection.
+ *
+ * Labels leave gaps, so the tree can change without renumbering it.
+ * insert() puts a node just linked between its neighbours' labels and
+ * into its tag's postings. When the gap is used up, the smallest aligned
+ * label range around it that is sparse enough is spread out again (list
+ * labeling: O(log^2 n) amortized labels moved per insert). erase() drops
+ * a subtree from the postings of the tags in it.
+ */
+class TagIndex {
+    public:
+        explicit TagIndex(const Tree& tree);
+
+        std::uint64_t rank(NodeIndex node) const { return rank_[node]; }
+        std::uint64_t end(NodeIndex node) const { return end_[node]; }
+
+        bool is_ancestor(NodeIndex ancestor, NodeIndex node) const
+        {
+            return rank_[ancestor] < rank_[node] &&
+                   rank_[node] < end_[ancestor];
+        }
+
+        /*
+         * Append to out, in document order, the nodes with tag (any_tag:
+         * any) strictly below a node of from, which has to be in document
+         * order. A null from stands for the whole document.
+         */
+        void descendants(const std::vector<NodeIndex>* from, Symbol tag,
+                         std::vector<NodeIndex>& out) const;
+
+        /* node was just linked as the last child of its parent or root */
+        void insert(NodeIndex node);
+        /* node and its subtree are about to be unlinked */
+        void erase(NodeIndex node);
+
+    private:
+        /* Entering or leaving node; no_node stands for the document */
+        struct Event {
+            NodeIndex node;
+            bool leave;
+        };
+
+        static constexpr std::uint64_t top = std::uint64_t{1} << 62;
+
+        std::uint64_t label(Event e) const;
+        void set_label(Event e, std::uint64_t label);
+        Event next(Event e) const;
+        Event prev(Event e) const;
+        void spread(Event before, NodeIndex node);
+        void collect(std::uint64_t after, std::uint64_t before, Symbol tag,
+                     std::vector<NodeIndex>& out) const;
+        void walk(Event first, Event last, std::vector<NodeIndex>& out) const;
+
+        const Tree& tree_;
+        std::vector<std::uint64_t> rank_;
+        std::vector<std::uint64_t> end_;
+        std::vector<std::vector<NodeIndex>> postings_;
+};
+
+}
+#endif
@@ -2,12 +2,53 @@
 #include<string>
 #include<sstream>
 #include<cctype>
+#include<cstdio>
+#include<cstring>
+#include<map>
+#include<random>
+#include<fstream>
+#include<functional>
+#include<thread>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<unistd.h>
 
 #include "hrml.h"
+#include "batch.h"
+#include "document_handle.h"
+#include "events.h"
+#include "flat_map.h"
+#include "generator.h"
+#include "query_cache.h"
+#include "scanner.h"
+#include "server.h"
+#include "snapshot.h"
 
 using namespace HRML;
 
 
+/*
+ * Temporary file holding `content`, removed when it goes out of scope.
+ */
+class TempFile {
+    public:
+        TempFile(const std::string& content)
+        {
+            char name[] = "/tmp/hrml_test_XXXXXX";
+            int fd = mkstemp(name);
+            close(fd);
+            path_ = name;
+            std::ofstream{path_} << content;
+        }
+        ~TempFile(void) { std::remove(path_.c_str()); }
+
+        const std::string& path(void) const { return path_; }
+
+    private:
+        std::string path_;
+};
+
+
 TEST(hrml_test, hrml_input_creation_correct_input_format) {
     std::istringstream in {
         "4 3\n" \
@@ -26,14 +67,17 @@ TEST(hrml_test, hrml_input_creation_correct_input_format) {
     ASSERT_EQ(hrml.number_source_nodes(), 4);
     ASSERT_EQ(hrml.number_queries(), 3);
 
-    auto root_node = hrml.root_node("tag1").lock();
-    ASSERT_TRUE(root_node != nullptr);
-    ASSERT_TRUE(root_node->attribute("value") == "HelloWorld");
+    auto root_node = hrml.root_node("tag1");
+    ASSERT_TRUE(root_node);
+    ASSERT_TRUE(root_node.attribute("value") == "HelloWorld");
 
-    auto child_node = root_node->child("tag2").lock();
-    ASSERT_TRUE(child_node != nullptr);
-    ASSERT_TRUE(child_node->attribute("name1") == "Name1");
-    ASSERT_TRUE(child_node->attribute("name2") == "Name2");
+    auto child_node = root_node.child("tag2");
+    ASSERT_TRUE(child_node);
+    ASSERT_TRUE(child_node.attribute("name1") == "Name1");
+    ASSERT_TRUE(child_node.attribute("name2") == "Name2");
+    ASSERT_EQ(child_node.parent().index(), root_node.index());
+    ASSERT_FALSE(root_node.parent());
+    ASSERT_FALSE(root_node.child("tag3"));
 
     std::ostringstream out;
     out << hrml;
@@ -151,6 +195,1645 @@ TEST(hrml_test, hrml_node_parse_error_no_attribute_name) {
     ASSERT_FALSE(node.is_valid());
 }
 
+TEST(hrml_test, hrml_node_parse_closing_tag) {
+    std::string ss = "</tag1>";
+    Node node{ss};
+    ASSERT_TRUE(node.is_valid());
+    ASSERT_TRUE(node.is_closing_node());
+    ASSERT_EQ(node.tag(), "tag1");
+}
+
+
+TEST(hrml_test, hrml_node_parse_escaped_value) {
+    std::string ss = "<tag1 a = \"x\\y\" b = \"z\">";
+    Node node{ss};
+    ASSERT_TRUE(node.is_valid());
+    ASSERT_EQ(node.attribute("a"), "xy");
+    ASSERT_EQ(node.attribute("b"), "z");
+}
+
+
+TEST(hrml_test, hrml_node_parse_error_unterminated_value) {
+    std::string ss = "<tag1 value = \"HelloWorld>";
+    Node node{ss};
+    ASSERT_FALSE(node.is_valid());
+}
+
+TEST(hrml_test, hrml_scanner_kernels_agree) {
+    std::string s;
+    for (int i = 0; i < 200; i++)
+        s += static_cast<char>('a' + i % 26);
+
+    for (std::size_t pos : {0, 5, 15, 16, 31, 32, 33, 63, 150, 199}) {
+        std::string t = s;
+        t[pos] = '=';
+        const char* last = t.data() + t.size();
+        for (auto kernel : {ScanKernel::scalar, ScanKernel::sse2,
+                            ScanKernel::avx2}) {
+            if (!scan_kernel_supported(kernel))
+                continue;
+            ASSERT_EQ(find_delimiter(kernel, t.data(), last,
+                                     structural_delimiters) - t.data(),
+                      static_cast<long>(pos));
+        }
+    }
+
+    const char* last = s.data() + s.size();
+    ASSERT_EQ(find_delimiter(s.data(), last, structural_delimiters), last);
+}
+
+TEST(hrml_test, hrml_load_file_matches_stream) {
+    std::string doc =
+        "4 3\n" \
+        "<tag1 value = \"HelloWorld\">\n" \
+        "<tag2 name = \"Name1\">\n" \
+        "</tag2>\n" \
+        "</tag1>\n" \
+        "tag1.tag2~name\n" \
+        "tag1~name\n" \
+        "tag1~value";
+    TempFile file{doc};
+
+    Hrml from_file;
+    from_file.load_file(file.path());
+
+    std::istringstream in{doc};
+    Hrml from_stream;
+    in >> from_stream;
+
+    std::ostringstream out_file, out_stream;
+    out_file << from_file;
+    out_stream << from_stream;
+    ASSERT_EQ(from_file.number_source_nodes(), 4);
+    ASSERT_EQ(from_file.number_queries(), 3);
+    ASSERT_EQ(out_file.str(), out_stream.str());
+}
+
+
+TEST(hrml_test, hrml_load_file_errors) {
+    Hrml missing;
+    ASSERT_THROW(missing.load_file("/nonexistent/hrml/input"), HrmlFail);
+
+    TempFile extra_line{
+        "2 1\n" \
+        "<tag1 value = \"HelloWorld\">\n" \
+        "</tag1>\n" \
+        "tag1~value\n" \
+        "tag1~value\n"
+    };
+    Hrml incomplete;
+    ASSERT_THROW(incomplete.load_file(extra_line.path()), HrmlIncompleteRead);
+
+    TempFile bad_header{"2 A\n"};
+    Hrml numerical;
+    ASSERT_THROW(numerical.load_file(bad_header.path()),
+                 HrmlNumericalDescription);
+
+    TempFile short_nodes{"3 1\n<tag1>\n</tag1>\n"};
+    Hrml nodes;
+    ASSERT_THROW(nodes.load_file(short_nodes.path()), HrmlNodeError);
+}
+
+/*
+ * Records parse events as "+tag(name=value,...)" and "-tag" strings.
+ */
+class RecordingHandler: public EventHandler {
+    public:
+        void on_open(std::string_view tag,
+                     const std::vector<TokenAttribute>& attributes) override
+        {
+            std::string e = "+" + std::string(tag) + "(";
+            for (const auto& attr : attributes)
+                e += attr.name_str() + "=" + attr.value_str() + ",";
+            events.push_back(e + ")");
+        }
+
+        void on_close(std::string_view tag) override
+        {
+            events.push_back("-" + std::string(tag));
+        }
+
+        std::vector<std::string> events;
+};
+
+
+TEST(hrml_test, hrml_events_stream_document) {
+    std::istringstream in {
+        "4 1\n" \
+        "<tag1 value = \"HelloWorld\">\n" \
+        "<tag2 name1 = \"Name1\" name2 = \"Name2\">\n" \
+        "</tag2>\n" \
+        "</tag1>\n" \
+        "tag1~value\n"
+    };
+
+    RecordingHandler handler;
+    EventParser parser{handler};
+    parser.parse(in);
+
+    std::vector<std::string> expect{
+        "+tag1(value=HelloWorld,)",
+        "+tag2(name1=Name1,name2=Name2,)",
+        "-tag2",
+        "-tag1"
+    };
+    ASSERT_EQ(handler.events, expect);
+    ASSERT_EQ(parser.depth(), 0u);
+
+    std::string rest;
+    std::getline(in, rest);
+    ASSERT_EQ(rest, "tag1~value");
+}
+
+
+TEST(hrml_test, hrml_events_bad_closing_tag) {
+    RecordingHandler handler;
+    EventParser parser{handler};
+    parser.feed("<tag1>");
+    parser.feed("<tag2>");
+    ASSERT_EQ(parser.depth(), 2u);
+    ASSERT_THROW(parser.feed("</tag1>"), HrmlParse);
+
+    EventParser empty{handler};
+    ASSERT_THROW(empty.feed("</tag1>"), HrmlParse);
+    ASSERT_THROW(empty.feed("<tag1 value =>"), HrmlParse);
+}
+
+TEST(hrml_test, hrml_symbol_table) {
+    SymbolTable symbols;
+    Symbol a = symbols.intern("tag1");
+    Symbol b = symbols.intern("value");
+    ASSERT_NE(a, b);
+    ASSERT_EQ(symbols.intern("tag1"), a);
+    ASSERT_EQ(symbols.find("value"), b);
+    ASSERT_EQ(symbols.find("missing"), no_symbol);
+    ASSERT_EQ(symbols.name(a), "tag1");
+    ASSERT_EQ(symbols.size(), 2u);
+}
+
+
+TEST(hrml_test, hrml_events_match_by_symbol) {
+    SymbolTable symbols;
+    RecordingHandler handler;
+    EventParser parser{handler, &symbols};
+    parser.feed("<tag1>");
+    ASSERT_EQ(parser.symbol(), symbols.find("tag1"));
+    parser.feed("<tag2>");
+    parser.feed("</tag2>");
+    ASSERT_THROW(parser.feed("</tag3>"), HrmlParse);
+    parser.feed("</tag1>");
+    ASSERT_EQ(parser.depth(), 0u);
+    ASSERT_THROW(parser.feed("</tag1>"), HrmlParse);
+}
+
+
+TEST(hrml_test, hrml_flat_map_matches_map) {
+    std::mt19937 rng{7};
+    for (unsigned n : {1u, 3u, 4u, 5u, 8u, 9u, 30u}) {
+        FlatMap<unsigned, std::string> flat;
+        std::map<unsigned, std::string> reference;
+        for (unsigned i = 0; i < n * 2; i++) {
+            unsigned key = rng() % (n + 1);
+            flat[key] = std::to_string(i);
+            reference[key] = std::to_string(i);
+        }
+
+        FlatMap<unsigned, std::string> copy{flat};
+        FlatMap<unsigned, std::string> moved{std::move(copy)};
+        ASSERT_EQ(moved.size(), reference.size());
+        for (unsigned key = 0; key <= n + 1; key++) {
+            auto it = reference.find(key);
+            auto value = moved.find(key);
+            if (it == reference.end()) {
+                ASSERT_EQ(value, nullptr);
+            } else {
+                ASSERT_NE(value, nullptr);
+                ASSERT_EQ(*value, it->second);
+            }
+        }
+    }
+}
+
+
+TEST(hrml_test, hrml_tree_attribute_spans_match_map) {
+    std::mt19937 rng{11};
+    for (unsigned n : {1u, 3u, 16u, 17u, 30u}) {
+        // Repeated names included, the last value wins
+        std::string line = "<t";
+        std::map<std::string, std::string> reference;
+        for (unsigned i = 0; i < n * 2; i++) {
+            std::string name = "k" + std::to_string(rng() % (n + 1));
+            std::string value = "v" + std::to_string(i);
+            line += " " + name + " = \"" + value + "\"";
+            reference[name] = value;
+        }
+        line += ">";
+        Token token;
+        ASSERT_TRUE(tokenize(line, token));
+
+        Tree tree;
+        Symbol tag = tree.symbols().intern("t");
+        NodeIndex eager = tree.add(no_node, tag, token.attributes);
+        NodeIndex lazy = tree.add_lazy(no_node, tag, line, token.attributes);
+
+        auto check = [&](NodeIndex node) {
+            ASSERT_EQ(tree.attributes(node).size, reference.size());
+            for (unsigned key = 0; key <= n + 1; key++) {
+                std::string name = "k" + std::to_string(key);
+                auto it = reference.find(name);
+                auto value = tree.attribute(node, tree.symbols().find(name));
+                if (it == reference.end()) {
+                    ASSERT_EQ(value, nullptr);
+                } else {
+                    ASSERT_NE(value, nullptr);
+                    ASSERT_EQ(*value, it->second);
+                }
+            }
+        };
+        check(eager);
+        check(lazy);
+
+        for (unsigned i = 0; i < n; i++) {
+            std::string name = "k" + std::to_string(rng() % (n + 2));
+            Symbol key = tree.symbols().intern(name);
+            if (rng() % 3 == 0) {
+                bool had = reference.erase(name) != 0;
+                ASSERT_EQ(tree.remove_attribute(eager, key), had);
+                ASSERT_EQ(tree.remove_attribute(lazy, key), had);
+            } else {
+                reference[name] = "set" + std::to_string(i);
+                tree.set_attribute(eager, key, reference[name]);
+                tree.set_attribute(lazy, key, reference[name]);
+            }
+            check(eager);
+            check(lazy);
+        }
+    }
+}
+
+
+/*
+ * Document with `roots` top level tags each holding a chain of `depth`
+ * nested tags, plus one query per chain level.
+ */
+static std::string
+nested_document(unsigned roots, unsigned depth)
+{
+    std::ostringstream nodes, queries;
+    for (unsigned r = 0; r < roots; r++) {
+        std::string path = "r" + std::to_string(r);
+        nodes << "<r" << r << " id = \"" << r << "\">\n";
+        for (unsigned d = 0; d < depth; d++)
+            nodes << "<t" << d << " v = \"" << r << "." << d << "\">\n";
+        for (unsigned d = depth; d-- > 0;)
+            nodes << "</t" << d << ">\n";
+        nodes << "</r" << r << ">\n";
+        for (unsigned d = 0; d < depth; d++) {
+            path += ".t" + std::to_string(d);
+            queries << path << "~v\n";
+        }
+    }
+    return std::to_string(roots * (depth + 1) * 2) + " " +
+           std::to_string(roots * depth) + "\n" + nodes.str() +
+           queries.str();
+}
+
+
+static std::string
+answers(const std::string& doc, const Options& options = Options())
+{
+    std::istringstream in{doc};
+    Hrml hrml{options};
+    in >> hrml;
+    std::ostringstream out;
+    out << hrml;
+    return out.str();
+}
+
+
+TEST(hrml_test, hrml_batch_shared_prefixes_keep_order) {
+    // Queries come root by root, deepest last; a sorted batch would not
+    std::string expect;
+    for (unsigned r = 0; r < 20; r++)
+        for (unsigned d = 0; d < 5; d++)
+            expect += std::to_string(r) + "." + std::to_string(d) + "\n";
+
+    std::string doc = nested_document(20, 5);
+    doc += "r3.t0.t1.t9~v\nr3.t0~w\nr3.t0.t1~v\nr99.t0~v\n";
+    doc.replace(0, doc.find('\n'), "240 104");
+    ASSERT_EQ(answers(doc), expect + "Not Found!\nNot Found!\n3.1\n" \
+                                     "Not Found!\n");
+}
+
+
+TEST(hrml_test, hrml_parallel_parse_matches_sequential) {
+    Options options;
+    options.parse_threads = 4;
+    options.parse_chunk = 3;
+
+    std::string doc = nested_document(50, 6);
+    ASSERT_EQ(answers(doc), answers(doc, options));
+}
+
+
+TEST(hrml_test, hrml_parallel_queries_keep_order) {
+    Options options;
+    options.query_threads = 4;
+    options.query_chunk = 7;
+
+    std::string doc = nested_document(50, 6);
+    ASSERT_EQ(answers(doc), answers(doc, options));
+}
+
+
+TEST(hrml_test, hrml_parallel_parse_same_error) {
+    Options options;
+    options.parse_threads = 4;
+    options.parse_chunk = 3;
+
+    std::string doc = nested_document(50, 6);
+    doc.replace(doc.find("</t2>", doc.size() / 2), 5, "</t9>");
+    doc.replace(doc.rfind("<t1 "), 3, "<t1=");
+
+    std::string sequential, parallel;
+    try {
+        answers(doc);
+    } catch (const HrmlParse& e) {
+        sequential = e.what();
+    }
+    try {
+        answers(doc, options);
+    } catch (const HrmlParse& e) {
+        parallel = e.what();
+    }
+    ASSERT_EQ(sequential, "Error parsing - bad tag: t9");
+    ASSERT_EQ(sequential, parallel);
+}
+
+TEST(hrml_test, hrml_wide_node_child_index) {
+    // 200 children over 50 tags, above the index threshold
+    std::ostringstream doc;
+    doc << "402 52\n<root>\n";
+    for (unsigned i = 0; i < 200; i++)
+        doc << "<c" << i % 50 << " i = \"" << i << "\">\n</c" << i % 50
+            << ">\n";
+    doc << "</root>\n";
+    for (unsigned t = 0; t < 50; t++)
+        doc << "root.c" << t << "~i\n";
+    doc << "root.root~i\nroot.c50~i\n";
+
+    std::string expect;
+    for (unsigned t = 0; t < 50; t++)
+        expect += std::to_string(t) + "\n";
+    expect += "Not Found!\nNot Found!\n";
+    ASSERT_EQ(answers(doc.str()), expect);
+}
+
+TEST(hrml_test, hrml_child_tables_reuse_blocks) {
+    Tree tree;
+    std::vector<Symbol> tags;
+    for (unsigned i = 0; i < 300; i++)
+        tags.push_back(tree.symbols().intern("c" + std::to_string(i)));
+    NodeIndex root = tree.add(no_node, tags[0], {});
+    tree.build_child_indexes();
+
+    // Each round grows a table through four sizes, then drops it
+    std::size_t bytes = 0;
+    for (unsigned round = 0; round < 20; round++) {
+        NodeIndex wide = tree.add(root, tags[1], {});
+        std::vector<NodeIndex> children;
+        for (Symbol tag : tags)
+            children.push_back(tree.add(wide, tag, {}));
+        for (std::size_t i = 0; i < tags.size(); i++)
+            ASSERT_EQ(tree.child(wide, tags[i]).index(), children[i]);
+        tree.remove(wide);
+        if (round == 0)
+            bytes = tree.child_index_bytes();
+    }
+    ASSERT_EQ(tree.child_index_bytes(), bytes);
+}
+
+TEST(hrml_test, hrml_root_index_first_match) {
+    std::ostringstream doc;
+    doc << "60 11\n";
+    for (unsigned i = 0; i < 30; i++)
+        doc << "<r" << i % 10 << " i = \"" << i << "\">\n</r" << i % 10
+            << ">\n";
+    for (unsigned t = 0; t < 10; t++)
+        doc << "r" << t << "~i\n";
+    doc << "r10~i\n";
+
+    std::string expect;
+    for (unsigned t = 0; t < 10; t++)
+        expect += std::to_string(t) + "\n";
+    expect += "Not Found!\n";
+    ASSERT_EQ(answers(doc.str()), expect);
+}
+
+TEST(hrml_test, hrml_query_plan_cache) {
+    std::istringstream in {
+        "4 5\n" \
+        "<tag1 value = \"HelloWorld\">\n" \
+        "<tag2 name = \"Name1\">\n" \
+        "</tag2>\n" \
+        "</tag1>\n" \
+        "tag1.tag2~name\n" \
+        "tag1~value\n" \
+        "tag1.tag2~name\n" \
+        "tag1~ value\n" \
+        "tag1.tag2~name\n"
+    };
+    Hrml hrml;
+    in >> hrml;
+
+    std::ostringstream out;
+    out << hrml;
+    ASSERT_EQ(out.str(), "Name1\nHelloWorld\nName1\nHelloWorld\nName1\n");
+    ASSERT_EQ(hrml.query_cache().hits(), 2u);
+    ASSERT_EQ(hrml.query_cache().misses(), 3u);
+}
+
+
+TEST(hrml_test, hrml_query_cache_evicts_lru) {
+    SymbolTable symbols;
+    symbols.intern("a");
+    QueryCache cache{2};
+
+    cache.plan("a~x", symbols);
+    cache.plan("b~x", symbols);
+    cache.plan("a~x", symbols);   // b~x is now the oldest
+    cache.plan("c~x", symbols);
+    ASSERT_EQ(cache.size(), 2u);
+    cache.plan("a~x", symbols);
+    cache.plan("b~x", symbols);
+    ASSERT_EQ(cache.hits(), 2u);
+    ASSERT_EQ(cache.misses(), 4u);
+
+    auto plan = cache.plan("a.b~x", symbols);
+    ASSERT_EQ(plan->steps.size(), 3u);
+    ASSERT_EQ(plan->steps[0].symbol, symbols.find("a"));
+    ASSERT_EQ(plan->steps[1].symbol, no_symbol);
+    ASSERT_EQ(plan->steps[2].kind, QueryStep::attribute);
+}
+
+TEST(hrml_test, hrml_query_cache_shared_by_threads) {
+    Options options;
+    options.query_threads = 4;
+    options.query_chunk = 7;
+    options.query_cache_size = 16;
+    Hrml hrml{options};
+    std::istringstream in{nested_document(20, 4)};
+    in >> hrml;
+
+    // Every text five times over, more texts than the cache holds
+    std::vector<std::string> texts;
+    for (unsigned r = 0; r < 20; r++)
+        for (unsigned d = 0; d < 4; d++)
+            texts.push_back("r" + std::to_string(r) + ".t0" +
+                            (d > 0 ? ".t1" : "") + "~v");
+    std::vector<std::string_view> queries;
+    std::string expect;
+    for (unsigned k = 0; k < 5; k++)
+        for (const auto& text : texts) {
+            queries.push_back(text);
+            expect += std::string(hrml.answer(text)) + "\n";
+        }
+
+    std::ostringstream first;
+    first << hrml;
+    hrml.clear_answers();
+    hrml.answer_queries(queries);
+    std::ostringstream out;
+    out << hrml;
+    ASSERT_EQ(out.str(), expect);
+    ASSERT_EQ(hrml.query_cache().hits() + hrml.query_cache().misses(),
+              80u + queries.size());
+    ASSERT_LE(hrml.query_cache().size(), 16u);
+}
+
+TEST(hrml_test, hrml_path_index_matches_child_lookups) {
+    Options options;
+    options.path_index = true;
+
+    // Only the second a has a b, only the second d an e
+    std::string doc = nested_document(30, 8);
+    doc.insert(doc.find("r0.t0~v"),
+               "<a>\n</a>\n<a>\n<b x = \"1\">\n</b>\n</a>\n" \
+               "<c>\n<d>\n</d>\n<d>\n<e y = \"2\">\n</e>\n</d>\n</c>\n" \
+               "a.b~x\nc.d.e~y\nc.d~y\nr7.t0.t1.t2~v\nr7.t1~v\n");
+    doc.replace(0, doc.find('\n'), "554 245");
+
+    ASSERT_EQ(answers(doc), answers(doc, options));
+    std::string expect = "Not Found!\nNot Found!\nNot Found!\n7.2\n" \
+                         "Not Found!\n0.0\n";
+    ASSERT_EQ(answers(doc, options).substr(0, expect.size()), expect);
+
+    std::istringstream in{doc};
+    Hrml indexed{options}, plain;
+    in >> indexed;
+    ASSERT_GT(indexed.path_index_bytes(), 0u);
+    ASSERT_EQ(plain.path_index_bytes(), 0u);
+}
+
+TEST(hrml_test, hrml_lazy_attributes_match_eager) {
+    Options lazy;
+    lazy.lazy_attributes = true;
+    Options lazy_parallel = lazy;
+    lazy_parallel.parse_threads = 4;
+    lazy_parallel.parse_chunk = 5;
+    lazy_parallel.query_threads = 4;
+    lazy_parallel.query_chunk = 7;
+
+    std::string doc = nested_document(40, 6);
+    ASSERT_EQ(answers(doc), answers(doc, lazy));
+    ASSERT_EQ(answers(doc), answers(doc, lazy_parallel));
+
+    std::string escaped =
+        "6 5\n" \
+        "<a \"k\" = \"x\\y\" k2 = \"\" k3 = \"v\">\n" \
+        "<b>\n</b>\n<a k = \"dup\">\n</a>\n</a>\n" \
+        "a~k\na~k2\na~k3\na.a~k\na.b~k\n";
+    ASSERT_EQ(answers(escaped, lazy), "xy\nNot Found!\nv\ndup\n" \
+                                      "Not Found!\n");
+
+    // Values are still read from the mapping after load_file returns
+    TempFile file{doc};
+    Hrml hrml{lazy};
+    hrml.load_file(file.path());
+    ASSERT_EQ(hrml.root_node("r3").child("t0").attribute("v"), "3.0");
+}
+
+TEST(hrml_test, hrml_answers_are_views) {
+    std::string doc = nested_document(3000, 4);
+    doc += "r0~nope\n";
+    doc.replace(0, doc.find('\n'), "30000 12001");
+
+    std::istringstream in{doc};
+    Hrml hrml;
+    in >> hrml;
+    ASSERT_EQ(hrml.answers().size(), 12001u);
+    ASSERT_EQ(hrml.answers()[5], "1.1");
+    ASSERT_EQ(hrml.answers().back().data(), Hrml::not_found.data());
+
+    // Output spans several write blocks
+    std::string expect;
+    for (unsigned r = 0; r < 3000; r++)
+        for (unsigned d = 0; d < 4; d++)
+            expect += std::to_string(r) + "." + std::to_string(d) + "\n";
+    std::ostringstream out;
+    out << hrml;
+    ASSERT_EQ(out.str(), expect + "Not Found!\n");
+}
+
+TEST(hrml_test, hrml_answers_survive_more_documents) {
+    const std::string first = nested_document(10, 3);
+
+    // Enough values to grow every attribute vector of the tree
+    std::string nodes, queries, expect = answers(first);
+    for (unsigned r = 0; r < 2000; r++) {
+        std::string tag = "s" + std::to_string(r);
+        std::string value = "second document value " + std::to_string(r);
+        nodes += "<" + tag + " v = \"" + value + "\">\n</" + tag + ">\n";
+        queries += tag + "~v\n";
+        expect += value + "\n";
+    }
+    const std::string second = "4000 2000\n" + nodes + queries;
+    TempFile file{second};
+
+    Options lazy;
+    lazy.lazy_attributes = true;
+    for (const Options& options : {Options(), lazy}) {
+        for (bool mapped : {false, true}) {
+            Hrml hrml{options};
+            std::istringstream in{first};
+            in >> hrml;
+            if (mapped) {
+                hrml.load_file(file.path());
+            } else {
+                std::istringstream more{second};
+                more >> hrml;
+            }
+            // Answers keep the value they were given
+            hrml.set_attribute(hrml.root_node("r0").child("t0"), "v", "x");
+            std::ostringstream out;
+            out << hrml;
+            ASSERT_EQ(out.str(), expect);
+        }
+    }
+}
+
+TEST(hrml_test, hrml_query_server_pipelined) {
+    std::istringstream in{nested_document(10, 3)};
+    Hrml hrml;
+    in >> hrml;
+    hrml.clear_answers();
+
+    int queries[2], answers[2];
+    ASSERT_EQ(pipe(queries), 0);
+    ASSERT_EQ(pipe(answers), 0);
+    std::string sent = "r1.t0~v\nr2.t0.t1.t2~v\nr2~v\nr3.t0.t1~v";
+    ASSERT_EQ(write(queries[1], sent.data(), sent.size()),
+              static_cast<ssize_t>(sent.size()));
+    close(queries[1]);
+
+    QueryServer server{hrml};
+    server.serve(queries[0], answers[1]);
+    close(queries[0]);
+    close(answers[1]);
+
+    char buf[256];
+    ssize_t n = read(answers[0], buf, sizeof(buf));
+    close(answers[0]);
+    ASSERT_EQ(std::string(buf, n > 0 ? n : 0), "1.0\n2.2\nNot Found!\n3.1\n");
+    ASSERT_EQ(server.stats().queries(), 4u);
+    ASSERT_EQ(server.stats().bytes_in(), sent.size());
+    ASSERT_LE(server.stats().latency(50), server.stats().max_latency());
+}
+
+TEST(hrml_test, hrml_server_stats_latency_buckets) {
+    using std::chrono::nanoseconds;
+    ServerStats stats;
+    stats.record(1, nanoseconds(3));
+    stats.record(1, nanoseconds(1000));
+    stats.record(1, nanoseconds(INT64_MAX));
+    ASSERT_EQ(stats.latency(30), nanoseconds(3));
+    // A quarter of a power of two above, at most
+    ASSERT_GE(stats.latency(60), nanoseconds(1000));
+    ASSERT_LE(stats.latency(60), nanoseconds(1279));
+    ASSERT_EQ(stats.latency(100), nanoseconds(INT64_MAX));
+}
+
+/* Client socket connected to path, retried while the server starts */
+static int
+connect_to(const std::string& path)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    for (int attempt = 0; attempt < 2000; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&addr),
+                    sizeof(addr)) == 0) {
+            // A server that never answers fails the test, not hangs it
+            timeval timeout{5, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                       sizeof(timeout));
+            return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return -1;
+}
+
+TEST(hrml_test, hrml_query_server_concurrent_connections) {
+    std::istringstream in{nested_document(10, 3)};
+    Hrml hrml;
+    in >> hrml;
+    hrml.clear_answers();
+
+    TempFile socket_file{""};
+    QueryServer server{hrml, 64};
+    std::thread listener{[&] { server.listen(socket_file.path()); }};
+
+    // An idle client with half a line must not hold up the others
+    int idle = connect_to(socket_file.path());
+    ASSERT_GE(idle, 0);
+    ASSERT_EQ(write(idle, "r1.t0", 5), 5);
+
+    int active = connect_to(socket_file.path());
+    ASSERT_GE(active, 0);
+    ASSERT_EQ(write(active, "r1.t0~v\nr2~v\n", 13), 13);
+    std::string received;
+    char buf[256];
+    while (received.size() < 15) {
+        ssize_t n = read(active, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        received.append(buf, n);
+    }
+    ASSERT_EQ(received, "1.0\nNot Found!\n");
+
+    // Past max_line without a '\n' the connection is closed
+    int flood = connect_to(socket_file.path());
+    ASSERT_GE(flood, 0);
+    std::string line(100, 'x');
+    ASSERT_EQ(write(flood, line.data(), line.size()),
+              static_cast<ssize_t>(line.size()));
+    ASSERT_EQ(read(flood, buf, sizeof(buf)), 0);
+
+    server.stop();
+    listener.join();
+    close(idle);
+    close(active);
+    close(flood);
+    ASSERT_EQ(server.stats().queries(), 2u);
+}
+
+static std::unique_ptr<const Hrml>
+versioned_document(unsigned version)
+{
+    std::istringstream in{"2 0\n<doc v = \"" + std::to_string(version) +
+                          "\">\n</doc>\n"};
+    auto hrml = std::make_unique<Hrml>();
+    in >> *hrml;
+    return hrml;
+}
+
+
+TEST(hrml_test, hrml_document_handle_reclaims_unpinned) {
+    DocumentHandle handle{versioned_document(1)};
+    auto first = handle.pin();
+    ASSERT_EQ(first.version(), 1u);
+
+    ASSERT_EQ(handle.publish(versioned_document(2)), 2u);
+    auto second = handle.pin();
+    ASSERT_EQ(first->answer("doc~v"), "1");
+    ASSERT_EQ(second->answer("doc~v"), "2");
+    ASSERT_EQ(second->answer("doc~w"), "Not Found!");
+
+    // Version 1 is pinned, it has to wait
+    ASSERT_EQ(handle.reclaim(), 1u);
+    first = handle.pin();
+    ASSERT_EQ(first.version(), 2u);
+    ASSERT_EQ(handle.reclaim(), 0u);
+}
+
+
+TEST(hrml_test, hrml_document_handle_concurrent_readers) {
+    DocumentHandle handle{versioned_document(1), 4};
+    std::atomic<bool> done{false};
+    std::atomic<unsigned> bad{0};
+
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < 6; t++) {
+        readers.emplace_back([&]() {
+            std::uint64_t last = 0;
+            while (!done.load()) {
+                auto snapshot = handle.pin();
+                // Versions only move forward and match their content
+                if (snapshot.version() < last ||
+                    snapshot->answer("doc~v") !=
+                        std::to_string(snapshot.version()))
+                    ++bad;
+                last = snapshot.version();
+            }
+        });
+    }
+    for (unsigned v = 2; v <= 50; v++)
+        handle.publish(versioned_document(v));
+    done.store(true);
+    for (auto& reader : readers)
+        reader.join();
+
+    ASSERT_EQ(bad.load(), 0u);
+    ASSERT_EQ(handle.reclaim(), 0u);
+}
+
+/* Reference document for the mutation tests, edited alongside an Hrml */
+struct ModelNode {
+    std::string tag;
+    std::map<std::string, std::string> attributes;
+    std::vector<ModelNode> children;
+};
+
+
+static void
+model_lines(const ModelNode& node, std::vector<std::string>& lines)
+{
+    std::string open = "<" + node.tag;
+    for (const auto& attr : node.attributes)
+        open += " " + attr.first + " = \"" + attr.second + "\"";
+    lines.push_back(open + ">");
+    for (const auto& child : node.children)
+        model_lines(child, lines);
+    lines.push_back("</" + node.tag + ">");
+}
+
+
+static std::string
+model_text(const std::vector<ModelNode>& roots)
+{
+    std::vector<std::string> lines;
+    for (const auto& root : roots)
+        model_lines(root, lines);
+    std::string text;
+    for (const auto& line : lines)
+        text += line + "\n";
+    return text;
+}
+
+
+static void
+model_paths(const std::vector<ModelNode>& nodes, std::vector<unsigned>& path,
+            std::vector<std::vector<unsigned>>& paths)
+{
+    for (unsigned i = 0; i < nodes.size(); i++) {
+        path.push_back(i);
+        paths.push_back(path);
+        model_paths(nodes[i].children, path, paths);
+        path.pop_back();
+    }
+}
+
+
+TEST(hrml_test, hrml_mutations_match_reparse) {
+    const std::vector<std::string> tags{"a", "b", "c", "d"};
+    const std::vector<std::string> names{"x", "y", "z"};
+    std::mt19937 rng{7};
+    auto pick = [&](std::size_t n) { return rng() % n; };
+
+    // Every path up to depth 3 over the vocabulary, for every name
+    std::vector<std::string> queries;
+    std::vector<std::string> prefixes{""};
+    for (unsigned depth = 0; depth < 3; depth++) {
+        std::vector<std::string> longer;
+        for (const auto& prefix : prefixes)
+            for (const auto& tag : tags)
+                longer.push_back(prefix.empty() ? tag : prefix + "." + tag);
+        for (const auto& path : longer)
+            for (const auto& name : names)
+                queries.push_back(path + "~" + name);
+        prefixes = longer;
+    }
+    std::vector<std::string_view> views(queries.begin(), queries.end());
+
+    auto random_subtree = [&]() {
+        ModelNode node{tags[pick(tags.size())], {}, {}};
+        if (pick(2))
+            node.attributes[names[pick(names.size())]] =
+                std::to_string(pick(100));
+        for (unsigned i = pick(3); i > 0; i--)
+            node.children.push_back({tags[pick(tags.size())],
+                                     {{"x", std::to_string(pick(100))}},
+                                     {}});
+        return node;
+    };
+
+    // A wide first root, so its children are looked up through a table
+    std::vector<ModelNode> roots{{"a", {{"x", "w"}}, {}}, {"b", {}, {}}};
+    for (unsigned i = 0; i < 40; i++)
+        roots[0].children.push_back(random_subtree());
+
+    Options path_index, lazy;
+    path_index.path_index = true;
+    lazy.lazy_attributes = true;
+    for (const Options& options : {Options(), path_index, lazy}) {
+        std::vector<ModelNode> model = roots;
+        std::string text = model_text(model);
+        std::istringstream in{std::to_string(std::count(text.begin(),
+                                                        text.end(), '\n')) +
+                              " 0\n" + text};
+        Hrml hrml{options};
+        in >> hrml;
+
+        for (unsigned step = 0; step < 300; step++) {
+            std::vector<unsigned> path;
+            std::vector<std::vector<unsigned>> paths;
+            model_paths(model, path, paths);
+            // Often the wide root or one of its children
+            if (pick(3) == 0 || paths.empty())
+                path.clear();
+            else if (pick(2) == 0)
+                path = paths[pick(paths.size())];
+            else if (model[0].children.empty() || pick(4) == 0)
+                path = {0};
+            else
+                path = {0, static_cast<unsigned>(
+                            pick(model[0].children.size()))};
+
+            // Same node on both sides
+            std::vector<ModelNode>* siblings = &model;
+            ModelNode* node = nullptr;
+            NodeRef ref;
+            for (unsigned k = 0; k < path.size(); k++) {
+                node = &(*siblings)[path[k]];
+                ref = k == 0 ? hrml.first_root() : ref.first_child();
+                for (unsigned i = 0; i < path[k]; i++)
+                    ref = ref.next_sibling();
+                siblings = &node->children;
+            }
+
+            unsigned op = pick(4);
+            if (op == 1 && path.size() == 1 && path[0] == 0)
+                op = 2;  // keep the wide root
+            if (node == nullptr || op == 0) {
+                ModelNode subtree = random_subtree();
+                std::vector<std::string> lines;
+                model_lines(subtree, lines);
+                std::string source;
+                for (const auto& line : lines)
+                    source += line + "\n";
+                NodeRef added = hrml.insert(ref, source);
+                ASSERT_EQ(added.tag(), subtree.tag);
+                siblings->push_back(subtree);
+            } else if (op == 1) {
+                hrml.remove(ref);
+                std::vector<ModelNode>& parent = path.size() == 1
+                    ? model : [&]() -> std::vector<ModelNode>& {
+                        std::vector<ModelNode>* up = &model;
+                        for (unsigned k = 0; k + 1 < path.size(); k++)
+                            up = &(*up)[path[k]].children;
+                        return *up;
+                    }();
+                parent.erase(parent.begin() + path.back());
+            } else if (op == 2) {
+                std::string name = names[pick(names.size())];
+                std::string value = pick(5) ? std::to_string(pick(100)) : "";
+                hrml.set_attribute(ref, name, value);
+                node->attributes[name] = value;
+            } else {
+                std::string name = names[pick(names.size())];
+                ASSERT_EQ(hrml.remove_attribute(ref, name),
+                          node->attributes.erase(name) == 1);
+            }
+
+            if (step % 10 != 9)
+                continue;
+            hrml.clear_answers();
+            hrml.answer_queries(views);
+            std::ostringstream edited;
+            edited << hrml;
+
+            text = model_text(model);
+            std::string doc = std::to_string(std::count(text.begin(),
+                                                        text.end(), '\n')) +
+                " " + std::to_string(queries.size()) + "\n" + text;
+            for (const auto& query : queries)
+                doc += query + "\n";
+            ASSERT_EQ(edited.str(), answers(doc)) << "step " << step;
+        }
+    }
+}
+
+
+TEST(hrml_test, hrml_insert_rejects_bad_subtree) {
+    std::istringstream in{"2 0\n<a>\n</a>\n"};
+    Hrml hrml;
+    in >> hrml;
+
+    NodeRef root = hrml.root_node("a");
+    ASSERT_THROW(hrml.insert(root, "<b>\n"), HrmlParse);
+    ASSERT_THROW(hrml.insert(root, "<b>\n</c>\n"), HrmlParse);
+    ASSERT_THROW(hrml.insert(root, "<b>\n</b>\n</a>\n"), HrmlParse);
+    ASSERT_THROW(hrml.insert(root, "b\n"), HrmlNodeError);
+    ASSERT_FALSE(root.first_child());
+
+    hrml.insert(root, "<b v = \"1\">\n</b>");
+    ASSERT_EQ(hrml.answer("a.b~v"), "1");
+}
+
+TEST(hrml_test, hrml_pattern_queries) {
+    std::istringstream in{
+        "14 10\n"
+        "<a id = \"a\">\n"
+        "<b id = \"b1\">\n"
+        "<c id = \"c1\">\n"
+        "</c>\n"
+        "</b>\n"
+        "<d>\n"
+        "<b id = \"b2\">\n"
+        "<c id = \"c2\" v = \"2\">\n"
+        "</c>\n"
+        "</b>\n"
+        "</d>\n"
+        "</a>\n"
+        "<c id = \"c3\" v = \"3\">\n"
+        "</c>\n"
+        "a..c~id\n"
+        "a..c~v\n"
+        "a.*.c~id\n"
+        "a.*.b.c~v\n"
+        "a.*..c~v\n"
+        "*~id\n"
+        "a..d..c~id\n"
+        "a..e~id\n"
+        "a..c~w\n"
+        "a.b.c~id\n"};
+    Hrml hrml;
+    in >> hrml;
+    std::ostringstream out;
+    out << hrml;
+    ASSERT_EQ(out.str(), "c1\n2\nc1\n2\n2\na\nc2\n"
+                         "Not Found!\nNot Found!\nc1\n");
+
+    // Only an empty step between two names is a descendant step
+    for (const char* query : {".c~id", ".a~id", "..c~id", "a..~id",
+                              "a...c~id"})
+        ASSERT_EQ(hrml.answer(query), Hrml::not_found) << query;
+
+    // A new node is seen by the next pattern query
+    hrml.insert(hrml.root_node("a"), "<e id = \"e\">\n</e>");
+    ASSERT_EQ(hrml.answer("a..e~id"), "e");
+    hrml.remove(hrml.root_node("a"));
+    ASSERT_EQ(hrml.answer("c~id"), "c3");
+    ASSERT_EQ(hrml.answer("*~id"), "c3");
+}
+
+
+/* Answer of a pattern query, straight from the definition */
+static std::string
+model_answer(const ModelNode& top,
+             const std::vector<std::pair<bool, std::string>>& steps,
+             const std::string& name)
+{
+    std::map<const ModelNode*, unsigned> rank;
+    std::function<void(const ModelNode&)> number = [&](const ModelNode& n) {
+        rank.emplace(&n, static_cast<unsigned>(rank.size()));
+        for (const auto& child : n.children)
+            number(child);
+    };
+    number(top);
+    auto below = [&](const ModelNode& n, auto& self,
+                     std::vector<const ModelNode*>& out) -> void {
+        for (const auto& child : n.children) {
+            out.push_back(&child);
+            self(child, self, out);
+        }
+    };
+
+    // Leading exact steps take the first match
+    const ModelNode* node = &top;
+    std::size_t i = 0;
+    for (; i < steps.size() && !steps[i].first && steps[i].second != "*";
+         i++) {
+        const ModelNode* next = nullptr;
+        for (const auto& child : node->children)
+            if (child.tag == steps[i].second) {
+                next = &child;
+                break;
+            }
+        if (next == nullptr)
+            return "Not Found!";
+        node = next;
+    }
+
+    std::vector<const ModelNode*> set{node};
+    for (; i < steps.size(); i++) {
+        std::map<unsigned, const ModelNode*> next;
+        for (const ModelNode* n : set) {
+            std::vector<const ModelNode*> found;
+            if (steps[i].first)
+                below(*n, below, found);
+            else
+                for (const auto& child : n->children)
+                    found.push_back(&child);
+            for (const ModelNode* f : found)
+                if (steps[i].second == "*" || f->tag == steps[i].second)
+                    next.emplace(rank[f], f);
+        }
+        set.clear();
+        for (const auto& entry : next)
+            set.push_back(entry.second);
+    }
+    for (const ModelNode* n : set) {
+        auto it = n->attributes.find(name);
+        if (it != n->attributes.end() && !it->second.empty())
+            return it->second;
+    }
+    return "Not Found!";
+}
+
+
+TEST(hrml_test, hrml_pattern_queries_match_model) {
+    const std::vector<std::string> tags{"a", "b", "c", "*", "q"};
+    std::mt19937 rng{11};
+    auto pick = [&](std::size_t n) { return rng() % n; };
+
+    std::function<ModelNode(unsigned)> random_node = [&](unsigned depth) {
+        ModelNode node{tags[pick(3)], {}, {}};
+        if (pick(3))
+            node.attributes["x"] = std::to_string(pick(100));
+        if (pick(4) == 0)
+            node.attributes["y"] = pick(3) ? std::to_string(pick(100)) : "";
+        for (unsigned i = depth < 5 ? pick(4) : 0; i > 0; i--)
+            node.children.push_back(random_node(depth + 1));
+        return node;
+    };
+
+    std::vector<std::string> queries;
+    std::vector<std::vector<std::pair<bool, std::string>>> query_steps;
+    std::vector<std::string> query_names;
+    for (unsigned n = 0; n < 400; n++) {
+        std::vector<std::pair<bool, std::string>> steps;
+        std::string query;
+        for (unsigned k = 1 + pick(4); k > 0; k--) {
+            bool descendant = !steps.empty() && pick(3) == 0;
+            steps.emplace_back(descendant, tags[pick(tags.size())]);
+            if (descendant)
+                query += ".";
+            query += steps.back().second + ".";
+        }
+        query_names.push_back(pick(4) ? "x" : "y");
+        query.back() = '~';
+        queries.push_back(query + query_names.back());
+        query_steps.push_back(steps);
+    }
+
+    Options path_index, lazy;
+    path_index.path_index = true;
+    lazy.lazy_attributes = true;
+    for (const Options& options : {Options(), path_index, lazy}) {
+        ModelNode top{"", {}, {}};
+        for (unsigned i = 0; i < 4; i++)
+            top.children.push_back(random_node(1));
+        std::string text = model_text(top.children);
+        std::string doc = std::to_string(std::count(text.begin(), text.end(),
+                                                    '\n')) +
+            " " + std::to_string(queries.size()) + "\n" + text;
+        std::string expect;
+        for (std::size_t i = 0; i < queries.size(); i++) {
+            doc += queries[i] + "\n";
+            expect += model_answer(top, query_steps[i], query_names[i]) +
+                      "\n";
+        }
+        ASSERT_EQ(answers(doc, options), expect);
+
+        // Edits have to reach the index before the next query
+        std::istringstream in{doc};
+        Hrml hrml{options};
+        in >> hrml;
+        for (unsigned edit = 0; edit < 5; edit++) {
+            ModelNode added = random_node(3);
+            std::vector<std::string> lines;
+            model_lines(added, lines);
+            std::string source;
+            for (const auto& line : lines)
+                source += line + "\n";
+            hrml.insert(hrml.first_root(), source);
+            top.children[0].children.push_back(added);
+            for (std::size_t i = 0; i < queries.size(); i++)
+                ASSERT_EQ(hrml.answer(queries[i]),
+                          model_answer(top, query_steps[i], query_names[i]))
+                    << queries[i];
+        }
+    }
+}
+
+
+/* Handles to the nodes of a model tree, in the same shape */
+struct ModelRefs {
+    NodeRef ref;
+    std::vector<ModelRefs> children;
+};
+
+
+static ModelRefs
+model_refs(NodeRef ref, const ModelNode& node)
+{
+    ModelRefs refs{ref, {}};
+    NodeRef child = ref.first_child();
+    for (const auto& c : node.children) {
+        refs.children.push_back(model_refs(child, c));
+        child = child.next_sibling();
+    }
+    return refs;
+}
+
+
+TEST(hrml_test, hrml_pattern_index_follows_edits) {
+    const std::vector<std::string> tags{"a", "b", "c", "*"};
+    std::mt19937 rng{5};
+    auto pick = [&](std::size_t n) { return rng() % n; };
+
+    std::vector<std::string> queries;
+    std::vector<std::vector<std::pair<bool, std::string>>> query_steps;
+    for (unsigned n = 0; n < 60; n++) {
+        std::vector<std::pair<bool, std::string>> steps;
+        std::string query;
+        for (unsigned k = 1 + pick(3); k > 0; k--) {
+            bool descendant = !steps.empty() && pick(2) == 0;
+            steps.emplace_back(descendant, tags[pick(tags.size())]);
+            query += (descendant ? "." : "") + steps.back().second + ".";
+        }
+        query.back() = '~';
+        queries.push_back(query + "x");
+        query_steps.push_back(steps);
+    }
+
+    // Appends at one spot use up the label gap there, so labels get spread
+    unsigned serial = 0;
+    auto leaf = [&] {
+        return ModelNode{tags[pick(3)], {{"x", std::to_string(serial++)}}, {}};
+    };
+    auto source = [](const ModelNode& node) {
+        return model_text({node});
+    };
+
+    Hrml hrml;
+    std::istringstream in{"2 0\n<a x = \"r\">\n</a>\n"};
+    in >> hrml;
+    ModelNode top{"", {}, {ModelNode{"a", {{"x", "r"}}, {}}}};
+    ModelRefs refs{NodeRef(), {ModelRefs{hrml.first_root(), {}}}};
+    ASSERT_EQ(hrml.answer("a~x"), "r");
+
+    std::vector<std::size_t> chain;
+    for (unsigned edit = 0; edit < 300; edit++) {
+        // A random node, the document itself included
+        std::vector<std::size_t> path;
+        ModelNode* node = &top;
+        ModelRefs* ref = &refs;
+        while (!node->children.empty() && pick(3) != 0) {
+            path.push_back(pick(node->children.size()));
+            node = &node->children[path.back()];
+            ref = &ref->children[path.back()];
+        }
+
+        unsigned kind = pick(10);
+        if (kind < 2 && !path.empty() &&
+            (path.size() > 1 || top.children.size() > 1)) {
+            hrml.remove(ref->ref);
+            ModelNode* parent = &top;
+            ModelRefs* parent_ref = &refs;
+            for (std::size_t k = 0; k + 1 < path.size(); k++) {
+                parent = &parent->children[path[k]];
+                parent_ref = &parent_ref->children[path[k]];
+            }
+            parent->children.erase(parent->children.begin() + path.back());
+            parent_ref->children.erase(parent_ref->children.begin() +
+                                       path.back());
+            chain.clear();
+        } else {
+            if (kind < 7 && !chain.empty()) {
+                // Below the node added last, or next to it
+                if (kind >= 5)
+                    chain.pop_back();
+                node = &top;
+                ref = &refs;
+                for (std::size_t k : chain) {
+                    node = &node->children[k];
+                    ref = &ref->children[k];
+                }
+                path = chain;
+            }
+            ModelNode added = kind < 8 ? leaf() : ModelNode{"b", {}, {leaf(),
+                                                                      leaf()}};
+            NodeRef at = hrml.insert(ref->ref, source(added));
+            node->children.push_back(added);
+            ref->children.push_back(model_refs(at, added));
+            path.push_back(node->children.size() - 1);
+            chain = path;
+        }
+
+        for (std::size_t i = 0; i < queries.size(); i++)
+            ASSERT_EQ(hrml.answer(queries[i]),
+                      model_answer(top, query_steps[i], "x"))
+                << queries[i] << " after edit " << edit;
+    }
+}
+
+
+TEST(hrml_test, hrml_snapshot_matches_text) {
+    Options lazy;
+    lazy.lazy_attributes = true;
+    std::istringstream in{nested_document(30, 6)};
+    Hrml text{lazy};
+    in >> text;
+
+    // Removed nodes and edits have to show up as they are now
+    text.remove(text.root_node("r1"));
+    text.set_attribute(text.root_node("r2"), "v", "edited \"value\"");
+    text.insert(text.root_node("r3"), "<t0 v = \"second\">\n</t0>\n"
+                                      "<w v = \"\">\n</w>");
+    std::vector<std::string_view> queries{
+        "r0.t0.t1~v", "r1.t0~v", "r2~v", "r2~id", "r3.t0~v", "r3.w~v",
+        "r3..t5~v", "r29.t0.t1.t2.t3.t4.t5~v", "r3.*~v", "r0.t9~v"};
+    text.clear_answers();
+    text.answer_queries(queries);
+
+    TempFile file{""};
+    text.save_snapshot(file.path());
+
+    Options path_index;
+    path_index.path_index = true;
+    for (const Options& options : {Options(), path_index, lazy}) {
+        Hrml mapped{options};
+        mapped.open_snapshot(file.path());
+        mapped.answer_queries(queries);
+        ASSERT_EQ(mapped.answers(), text.answers());
+        ASSERT_EQ(mapped.number_source_nodes(), 2 * (29 * 7 + 2));
+
+        // A second open replaces the document
+        mapped.clear_answers();
+        mapped.open_snapshot(file.path());
+        mapped.answer_queries(queries);
+        ASSERT_EQ(mapped.answers(), text.answers());
+    }
+}
+
+
+TEST(hrml_test, hrml_snapshot_errors) {
+    Hrml hrml;
+    ASSERT_THROW(hrml.open_snapshot("/nonexistent/hrml/snapshot"), HrmlFail);
+
+    std::istringstream in{nested_document(3, 2)};
+    in >> hrml;
+    TempFile file{""};
+    hrml.save_snapshot(file.path());
+    std::ifstream saved{file.path(), std::ios::binary};
+    std::string image{std::istreambuf_iterator<char>(saved),
+                      std::istreambuf_iterator<char>()};
+
+    auto open = [&](const std::string& content) {
+        TempFile bad{content};
+        Hrml opened;
+        opened.open_snapshot(bad.path());
+    };
+    open(image);
+    for (std::size_t cut : {std::size_t{0}, std::size_t{20}, std::size_t{47},
+                            std::size_t{48}, image.size() / 2,
+                            image.size() - 1})
+        ASSERT_THROW(open(image.substr(0, cut)), HrmlSnapshotError) << cut;
+    ASSERT_THROW(open(image + "x"), HrmlSnapshotError);
+
+    std::string version = image;
+    version[8] = 2;
+    ASSERT_THROW(open(version), HrmlSnapshotError);
+    std::string magic = image;
+    magic[0] = 'X';
+    ASSERT_THROW(open(magic), HrmlSnapshotError);
+    // First node's parent pointing at itself
+    SnapshotHeader header;
+    std::memcpy(&header, image.data(), sizeof(header));
+    std::string parent = image;
+    NodeIndex self = 0;
+    std::memcpy(&parent[sizeof(header) +
+                        header.symbols * sizeof(SnapshotString) +
+                        offsetof(SnapshotNode, parent)],
+                &self, sizeof(self));
+    ASSERT_THROW(open(parent), HrmlSnapshotError);
+
+    // A failed open leaves the loaded document as it was
+    std::ostringstream before;
+    before << hrml;
+    for (const std::string& bad : {image.substr(0, 60), parent}) {
+        TempFile cut{bad};
+        ASSERT_THROW(hrml.open_snapshot(cut.path()), HrmlSnapshotError);
+        ASSERT_EQ(hrml.answer("r1.t0.t1~v"), "1.1");
+        std::ostringstream after;
+        after << hrml;
+        ASSERT_EQ(after.str(), before.str());
+    }
+}
+
+
+TEST(hrml_test, hrml_batch_documents) {
+    std::vector<std::string> documents;
+    for (unsigned i = 0; i < 40; i++)
+        documents.push_back(nested_document(1 + i % 5, 1 + i % 3));
+    documents[7] = "2 1\n<a>\n</b>\na~x\n";
+    documents[8] = "3 1\n<a>\n</a>\n";
+    documents[20] = "x\n";
+
+    Batch batch{Options(), 4};
+    std::vector<BatchResult> results = batch.answer(documents);
+    ASSERT_EQ(results.size(), documents.size());
+    for (std::size_t i = 0; i < documents.size(); i++) {
+        ASSERT_EQ(results[i].name, "document " + std::to_string(i + 1));
+        if (i == 7 || i == 8 || i == 20) {
+            ASSERT_FALSE(results[i].error.empty()) << i;
+            ASSERT_TRUE(results[i].answers.empty());
+        } else {
+            ASSERT_EQ(results[i].error, "");
+            ASSERT_EQ(results[i].answers, answers(documents[i]));
+        }
+    }
+    ASSERT_EQ(results[7].error, "Error parsing - bad tag: b");
+    ASSERT_EQ(results[20].error, "bad line count header");
+
+    // Same documents from files, in name order
+    char dir[] = "/tmp/hrml_batch_XXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    for (std::size_t i = 0; i < documents.size(); i++) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%03zu.hrml", i);
+        std::ofstream{dir + std::string(name)} << documents[i];
+    }
+    std::vector<BatchResult> files = batch.answer_directory(dir);
+    ASSERT_EQ(files.size(), documents.size());
+    for (std::size_t i = 0; i < documents.size(); i++) {
+        ASSERT_EQ(files[i].answers, results[i].answers) << i;
+        ASSERT_EQ(files[i].error.empty(), results[i].error.empty()) << i;
+        std::remove(files[i].name.c_str());
+    }
+    rmdir(dir);
+    ASSERT_THROW(batch.answer_directory("/nonexistent/hrml"), HrmlFail);
+}
+
+
+TEST(hrml_test, hrml_batch_stream) {
+    std::string stream, expect;
+    for (unsigned i = 0; i < 9; i++) {
+        std::string doc = i == 4 ? "2 1\n<a>\n</b>\na~x\n"
+                                 : nested_document(2 + i, 2);
+        stream += doc + (i % 2 ? "\n" : "");
+        expect += i == 4 ? "!document 5\n" : answers(doc);
+    }
+    stream += "oops\n" + nested_document(1, 1);
+    expect += "!document 10\n";
+
+    std::istringstream in{stream};
+    std::string got;
+    Batch batch{Options(), 3};
+    std::size_t count = batch.answer_stream(in, [&](const BatchResult& r) {
+        got += r.error.empty() ? r.answers : "!" + r.name + "\n";
+    }, 2);
+    ASSERT_EQ(count, 10u);
+    ASSERT_EQ(got, expect);
+}
+
+
+TEST(hrml_test, hrml_batch_stream_no_final_newline) {
+    std::istringstream in{"2 1\n<a v = \"x\">\n</a>\na~v\n"
+                          "2 1\n<b w = \"y\">\n</b>\nb~w"};
+    std::string got;
+    Batch batch{Options(), 2};
+    std::size_t count = batch.answer_stream(in, [&](const BatchResult& r) {
+        got += r.error.empty() ? r.answers : "!" + r.name + "\n";
+    });
+    ASSERT_EQ(count, 2u);
+    ASSERT_EQ(got, "x\ny\n");
+}
+
+
+TEST(hrml_test, hrml_generator_documents) {
+    GeneratorOptions few_tags;
+    few_tags.tags = 2;
+    few_tags.depth = 8;
+    GeneratorOptions geometric;
+    geometric.fanout_distribution = GeneratorOptions::geometric;
+    geometric.fanout = 6;
+    geometric.query_depth = 2;
+    GeneratorOptions fixed;
+    fixed.fanout_distribution = GeneratorOptions::fixed;
+    fixed.fanout = 2;
+    fixed.min_attributes = fixed.max_attributes = 1;
+    fixed.hit_ratio = 1;
+
+    for (GeneratorOptions options : {GeneratorOptions(), few_tags, geometric,
+                                     fixed}) {
+        options.nodes = 3000;
+        options.queries = 2000;
+        std::ostringstream out, again;
+        generate(options, out);
+        generate(options, again);
+        ASSERT_EQ(out.str(), again.str());
+
+        std::istringstream in{out.str()};
+        Hrml hrml;
+        in >> hrml;
+        ASSERT_EQ(hrml.number_source_nodes(), 6000u);
+        ASSERT_EQ(hrml.answers().size(), 2000u);
+
+        // Misses, and only misses, name what the document does not have
+        std::istringstream lines{out.str()};
+        std::string line;
+        for (unsigned i = 0; i <= 6000; i++)
+            std::getline(lines, line);
+        unsigned hits = 0;
+        for (auto answer : hrml.answers()) {
+            std::getline(lines, line);
+            bool miss = line.find("none") != std::string::npos;
+            ASSERT_EQ(answer == Hrml::not_found, miss) << line;
+            hits += !miss;
+        }
+        ASSERT_NEAR(hits / 2000.0, options.hit_ratio, 0.05);
+    }
+
+    GeneratorOptions other;
+    other.seed = 2;
+    std::ostringstream first, second;
+    generate(GeneratorOptions(), first);
+    generate(other, second);
+    ASSERT_NE(first.str(), second.str());
+}
+
+
+TEST(hrml_test, hrml_generator_query_skew) {
+    GeneratorOptions options;
+    options.queries = 5000;
+    options.distinct_queries = 100;
+    options.skew = 1.2;
+    std::ostringstream out;
+    generate(options, out);
+
+    std::istringstream lines{out.str()};
+    std::string line;
+    std::getline(lines, line);
+    for (unsigned i = 0; i < 2 * options.nodes; i++)
+        std::getline(lines, line);
+    std::map<std::string, unsigned> counts;
+    while (std::getline(lines, line))
+        counts[line]++;
+    unsigned top = 0;
+    for (const auto& count : counts)
+        top = std::max(top, count.second);
+    ASSERT_LE(counts.size(), 100u);
+    ASSERT_GT(top, 5000u / 100 * 10);
+
+    // The hit ratio holds for the written queries, not just the texts
+    for (double skew : {0.0, 1.2, 2.0})
+        for (std::uint64_t seed : {1u, 2u, 3u}) {
+            GeneratorOptions skewed = options;
+            skewed.skew = skew;
+            skewed.seed = seed;
+            std::ostringstream text;
+            generate(skewed, text);
+            std::istringstream in{text.str()};
+            Hrml hrml;
+            in >> hrml;
+            unsigned hits = 0;
+            for (auto answer : hrml.answers())
+                hits += answer != Hrml::not_found;
+            ASSERT_NEAR(hits / 5000.0, skewed.hit_ratio, 0.03)
+                << "skew " << skew << " seed " << seed;
+        }
+
+    GeneratorOptions bad;
+    bad.min_attributes = 5;
+    ASSERT_THROW(generate(bad, out), std::invalid_argument);
+    bad = GeneratorOptions();
+    bad.hit_ratio = 1.5;
+    ASSERT_THROW(generate(bad, out), std::invalid_argument);
+}
+
+
+TEST(hrml_test, hrml_stats) {
+    std::string doc =
+        "8 4\n"
+        "<r id = \"r\">\n"
+        "<a>\n"
+        "</a>\n"
+        "<b>\n"
+        "<c v = \"1\">\n"
+        "</c>\n"
+        "</b>\n"
+        "</r>\n"
+        "r~id\n"
+        "r.b.c~v\n"
+        "r.b~v\n"
+        "x~v\n";
+    Hrml plain;
+    std::istringstream plain_in{doc};
+    plain_in >> plain;
+    ASSERT_EQ(plain.stats(), nullptr);
+
+    Options options;
+    options.stats = true;
+    Hrml hrml{options};
+    std::istringstream in{doc};
+    in >> hrml;
+    std::ostringstream out;
+    out << hrml;
+    ASSERT_EQ(out.str(), "r\n1\nNot Found!\nNot Found!\n");
+
+    const Stats& stats = *hrml.stats();
+    ASSERT_EQ(stats.lines, 13u);
+    ASSERT_EQ(stats.bytes, doc.size());
+    ASSERT_EQ(stats.nodes, 4u);
+    ASSERT_EQ(stats.max_depth, 3u);
+    ASSERT_EQ(stats.queries, 4u);
+    ASSERT_EQ(stats.hits, 2u);
+    ASSERT_EQ(stats.misses, 2u);
+    // b is the second child of r, c the first of b; r.b~v and r.b.c~v
+    // share the lookup of b
+    ASSERT_EQ(stats.child_steps, 2u + 1u);
+    ASSERT_GT(stats.read_time.count(), 0);
+    ASSERT_GT(stats.link_time.count(), 0);
+    ASSERT_GT(stats.query_time.count(), 0);
+    ASSERT_NE(stats.summary().find("nodes 4 depth 3"), std::string::npos);
+
+    hrml.reset_stats();
+    ASSERT_EQ(hrml.stats()->queries, 0u);
+
+    // Counting does not change what is built
+    std::string nested = nested_document(40, 6);
+    Options parallel = options;
+    parallel.parse_threads = 3;
+    parallel.parse_chunk = 7;
+    Options lazy = options;
+    lazy.lazy_attributes = true;
+    for (const Options& counted : {options, parallel, lazy}) {
+        ASSERT_EQ(answers(nested, counted), answers(nested));
+        std::istringstream nested_in{nested};
+        Hrml counting{counted};
+        nested_in >> counting;
+        ASSERT_EQ(counting.stats()->nodes, 40u * 7);
+        ASSERT_EQ(counting.stats()->max_depth, 7u);
+        ASSERT_EQ(counting.stats()->hits, 40u * 6);
+    }
+
+    // A batch keeps each document's counters, and they add up
+    Batch batch{options, 2};
+    Stats total;
+    for (const auto& result : batch.answer({doc, nested, doc}))
+        total += result.stats;
+    ASSERT_EQ(total.nodes, 4u + 40u * 7 + 4u);
+    ASSERT_EQ(total.max_depth, 7u);
+    ASSERT_EQ(total.queries, 4u + 40u * 6 + 4u);
+    ASSERT_EQ(total.misses, 2u + 2u);
+}
+
 TEST(hrml_hacker_rank, hrml_test_01) {
     std::istringstream in {
         "4 3\n" \
@@ -0,0 +1,160 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace HRML {
+
+struct ThreadPool::Job {
+    const std::function<void(std::size_t, std::size_t)>& fn;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+
+ThreadPool::ThreadPool(unsigned threads)
+    : job_{nullptr}, generation_{0}, busy_{0}, stop_{false}
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned i = 0; i < threads; i++)
+        queues_.push_back(std::make_unique<Queue>());
+    for (unsigned i = 1; i < threads; i++)
+        workers_.emplace_back(&ThreadPool::worker, this, i);
+}
+
+
+ThreadPool::~ThreadPool(void)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : workers_)
+        t.join();
+}
+
+
+bool
+ThreadPool::next_range(unsigned id,
+                       std::pair<std::size_t, std::size_t>& range)
+{
+    {
+        Queue& own = *queues_[id];
+        std::lock_guard<std::mutex> lock{own.mutex};
+        if (!own.ranges.empty()) {
+            range = own.ranges.front();
+            own.ranges.pop_front();
+            return true;
+        }
+    }
+
+    for (std::size_t i = 1; i < queues_.size(); i++) {
+        Queue& victim = *queues_[(id + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock{victim.mutex};
+        if (!victim.ranges.empty()) {
+            range = victim.ranges.back();
+            victim.ranges.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void
+ThreadPool::run(Job& job, unsigned id)
+{
+    std::pair<std::size_t, std::size_t> range;
+
+    while (next_range(id, range)) {
+        try {
+            job.fn(range.first, range.second);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock{job.error_mutex};
+            if (!job.error)
+                job.error = std::current_exception();
+        }
+    }
+}
+
+
+void
+ThreadPool::worker(unsigned id)
+{
+    unsigned long seen = 0;
+
+    for (;;) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock{mutex_};
+            wake_.wait(lock, [&] {
+                return stop_ || (job_ != nullptr && generation_ != seen);
+            });
+            if (stop_)
+                return;
+            seen = generation_;
+            job = job_;
+            ++busy_;
+        }
+
+        run(*job, id);
+
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            --busy_;
+        }
+        done_.notify_one();
+    }
+}
+
+
+void
+ThreadPool::parallel_for(std::size_t n, std::size_t chunk,
+                         const std::function<void(std::size_t,
+                                                  std::size_t)>& fn)
+{
+    std::lock_guard<std::mutex> turn{job_mutex_};
+
+    if (chunk == 0)
+        chunk = 1;
+
+    Job job{fn, {}, {}};
+
+    // Deal the chunks out as one contiguous run per participant
+    std::size_t chunks = (n + chunk - 1) / chunk;
+    std::size_t participants = queues_.size();
+    for (std::size_t p = 0; p < participants; p++) {
+        std::size_t first = chunks * p / participants;
+        std::size_t last = chunks * (p + 1) / participants;
+        std::lock_guard<std::mutex> lock{queues_[p]->mutex};
+        for (std::size_t c = first; c < last; c++)
+            queues_[p]->ranges.emplace_back(c * chunk,
+                                            std::min(n, (c + 1) * chunk));
+    }
+
+    if (chunks > 1 && !workers_.empty()) {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            job_ = &job;
+            ++generation_;
+        }
+        wake_.notify_all();
+    }
+
+    run(job, 0);
+
+    {
+        // Workers that never woke up for this job find it exhausted
+        std::unique_lock<std::mutex> lock{mutex_};
+        done_.wait(lock, [&] { return busy_ == 0; });
+        job_ = nullptr;
+    }
+
+    if (job.error)
+        std::rethrow_exception(job.error);
+}
+
+}
@@ -0,0 +1,73 @@
+#ifndef THREAD_POOL_HPP_
+#define THREAD_POOL_HPP_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace HRML {
+
+/*
+ * Fixed set of worker threads running one parallel_for at a time.
+ * Every participant starts on its own contiguous share of the chunks and,
+ * once done, steals chunks from the far end of the others' queues, so
+ * uneven chunks do not leave threads idle.
+ */
+class ThreadPool {
+    public:
+        /* threads == 0 means one per hardware thread */
+        explicit ThreadPool(unsigned threads);
+        ~ThreadPool(void);
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /* Number of threads taking part in a job, the caller included */
+        unsigned size(void) const
+        {
+            return static_cast<unsigned>(workers_.size()) + 1;
+        }
+
+        /*
+         * Call fn(begin, end) over [0, n) in chunks of at most `chunk`
+         * items and wait for all of them. The calling thread works too.
+         * The first exception thrown by fn is rethrown here once every
+         * chunk has been handed out. Concurrent callers take turns.
+         */
+        void parallel_for(std::size_t n, std::size_t chunk,
+                          const std::function<void(std::size_t,
+                                                   std::size_t)>& fn);
+
+    private:
+        struct Job;
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<std::pair<std::size_t, std::size_t>> ranges;
+        };
+
+        void worker(unsigned id);
+        bool next_range(unsigned id, std::pair<std::size_t,
+                                               std::size_t>& range);
+        void run(Job& job, unsigned id);
+
+        std::vector<std::thread> workers_;
+        std::vector<std::unique_ptr<Queue>> queues_;  // 0 is the caller's
+        std::mutex job_mutex_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        Job* job_;
+        unsigned long generation_;
+        unsigned busy_;
+        bool stop_;
+};
+
+}
+#endif
@@ -0,0 +1,134 @@
+#include "tokenizer.h"
+#include "scanner.h"
+#include <cctype>
+
+namespace HRML {
+
+namespace {
+
+constexpr DelimiterSet value_delimiters{"\"\\"};
+
+
+bool
+is_name_char(char c)
+{
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+
+std::string
+strip(std::string_view s, char drop)
+{
+    std::string out;
+    out.reserve(s.size());
+    for (char c : s)
+        if (c != drop) out += c;
+    return out;
+}
+
+}
+
+
+std::string
+TokenAttribute::name_str(void) const
+{
+    return name_escaped ? strip(name, '"') : std::string(name);
+}
+
+
+std::string
+TokenAttribute::value_str(void) const
+{
+    return value_escaped ? strip(value, '\\') : std::string(value);
+}
+
+
+bool
+tokenize(std::string_view s, Token& token)
+{
+    const char* p = s.data();
+    const char* const end = p + s.size();
+    const char* first;
+
+    token.tag = std::string_view();
+    token.attributes.clear();
+    token.is_closing = false;
+    token.is_valid = false;
+
+    if (p == end || *p++ != '<')
+        return false;
+
+    first = p;
+    while (p != end && (is_name_char(*p) || *p == '"' || *p == '/'))
+        ++p;
+    std::string_view tag_name(first, p - first);
+
+    if (p == end)
+        return false;
+
+    if (*p == '>') {
+        if (!tag_name.empty() && tag_name[0] == '/') {
+            tag_name.remove_prefix(1);
+            token.is_closing = true;
+        }
+        token.tag = tag_name;
+        token.is_valid = true;
+        return true;
+    }
+
+    if (*p != ' ')
+        return false;
+
+    token.tag = tag_name;
+
+    do {
+        TokenAttribute attr{};
+
+        first = ++p;
+        while (p != end && (is_name_char(*p) || *p == '"')) {
+            attr.name_escaped |= *p == '"';
+            ++p;
+        }
+        attr.name = std::string_view(first, p - first);
+
+        // Attribute separator is exactly ` = "`
+        if (end - p < 4 || p[0] != ' ' || p[1] != '=' ||
+            p[2] != ' ' || p[3] != '"')
+            return false;
+        p += 4;
+
+        // Values can be long, let the scanner skip over them
+        first = p;
+        p = find_delimiter(p, end, value_delimiters);
+        while (p != end && *p == '\\') {
+            attr.value_escaped = true;
+            p = find_delimiter(p + 1, end, value_delimiters);
+        }
+        if (p == end)
+            return false;
+        attr.value = std::string_view(first, p - first);
+
+        ++p;
+        if (p == end || (*p != ' ' && *p != '>'))
+            return false;
+        token.attributes.push_back(attr);
+    } while (*p == ' ');
+
+    token.is_valid = true;
+    return true;
+}
+
+
+bool
+has_brackets(std::string_view s)
+{
+    static constexpr DelimiterSet brackets{"<>"};
+    const char* last = s.data() + s.size();
+    const char* p = find_delimiter(s.data(), last, brackets);
+    if (p == last)
+        return false;
+    const DelimiterSet other{*p == '<' ? ">" : "<"};
+    return find_delimiter(p + 1, last, other) != last;
+}
+
+}
@@ -0,0 +1,46 @@
+#ifndef TOKENIZER_HPP_
+#define TOKENIZER_HPP_
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace HRML {
+
+/*
+ * Attribute as found in a source line. Both views point into the tokenized
+ * buffer. Names drop every '"' and values drop every '\\', so when the
+ * matching *_escaped flag is set the view has to go through name_str() /
+ * value_str() before it can be stored.
+ */
+struct TokenAttribute {
+    std::string_view name;
+    std::string_view value;
+    bool name_escaped;
+    bool value_escaped;
+
+    std::string name_str(void) const;
+    std::string value_str(void) const;
+};
+
+
+/*
+ * One tokenized hrml line: "<tag a = "x">" or "</tag>".
+ * The token does not own any text, it is only valid while the source
+ * buffer is alive. Reusing a Token keeps the attribute vector capacity.
+ */
+struct Token {
+    std::string_view tag;
+    std::vector<TokenAttribute> attributes;
+    bool is_closing = false;
+    bool is_valid = false;
+};
+
+
+bool tokenize(std::string_view source, Token& token);
+
+/* Cheap check used before tokenizing: the line has both '<' and '>' */
+bool has_brackets(std::string_view source);
+
+}
+#endif
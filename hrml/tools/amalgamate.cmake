@@ -0,0 +1,38 @@
+# Writes OUTPUT, one C++ file holding MAIN and every file in SOURCES with
+# their local headers pasted in place of the #include lines, each header
+# once. Run as
+#   cmake -DSOURCE_DIR=... -DOUTPUT=... -DMAIN=... "-DSOURCES=a.cpp;b.cpp"
+#         -P amalgamate.cmake
+
+cmake_minimum_required(VERSION 3.10)
+
+set_property(GLOBAL PROPERTY AMALGAMATE_SEEN "")
+
+function(expand file result)
+    file(READ ${SOURCE_DIR}/${file} text)
+    string(REGEX MATCHALL "#include \"[^\"]+\"" directives "${text}")
+    foreach(directive ${directives})
+        string(REGEX REPLACE "#include \"([^\"]+)\"" "\\1" header
+               "${directive}")
+        get_property(seen GLOBAL PROPERTY AMALGAMATE_SEEN)
+        set(body "/* ${header} */")
+        if (NOT header IN_LIST seen)
+            set_property(GLOBAL APPEND PROPERTY AMALGAMATE_SEEN ${header})
+            expand(${header} included)
+            set(body "/* ${header} */\n${included}")
+        endif()
+        string(REPLACE "${directive}" "${body}" text "${text}")
+    endforeach()
+    set(${result} "${text}" PARENT_SCOPE)
+endfunction()
+
+set(amalgamation "/* Generated from the hrml sources, do not edit */\n")
+foreach(source ${SOURCES} ${MAIN})
+    expand(${source} text)
+    string(APPEND amalgamation "\n/* ${source} */\n${text}")
+endforeach()
+file(WRITE ${OUTPUT}.tmp "${amalgamation}")
+# Unchanged output keeps its time stamp, so nothing is rebuilt
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different
+                ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
@@ -0,0 +1,17 @@
+#include "hrml.h"
+
+#include <iostream>
+
+/*
+ * The plain HackerRank solution: a document and its queries on stdin,
+ * answers on stdout. The build pastes it after the library sources into
+ * one self-contained file that can be submitted as is.
+ */
+int main(void)
+{
+    HRML::Hrml hrml;
+    std::cin >> hrml;
+    std::cout << hrml;
+
+    return 0;
+}
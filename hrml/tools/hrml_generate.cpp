@@ -0,0 +1,116 @@
+#include "generator.h"
+
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+
+void
+usage(void)
+{
+    std::cerr <<
+        "usage: hrml_generate [options] > document\n"
+        "  --seed N                 same seed, same document (1)\n"
+        "  --nodes N                nodes in all (1000)\n"
+        "  --depth N                levels, roots are level 1 (6)\n"
+        "  --fanout X               mean children per node (3)\n"
+        "  --fanout-distribution D  fixed, uniform or geometric (uniform)\n"
+        "  --tags N                 tag vocabulary (50)\n"
+        "  --names N                attribute name vocabulary (20)\n"
+        "  --attributes LO[-HI]     attributes per node (0-4)\n"
+        "  --value-length LO[-HI]   attribute value length (1-16)\n"
+        "  --queries N              (1000)\n"
+        "  --hit-ratio X            share of queries answered (0.75)\n"
+        "  --query-depth N          longest query path (depth)\n"
+        "  --distinct N             distinct query texts (one per query)\n"
+        "  --skew X                 Zipf exponent of repeats, 0: even (0)\n"
+        "  --output PATH            instead of stdout\n";
+}
+
+
+/* "LO-HI" or a single value for both */
+void
+range(const std::string& arg, unsigned& lo, unsigned& hi)
+{
+    std::size_t dash = arg.find('-');
+    lo = static_cast<unsigned>(std::stoul(arg.substr(0, dash)));
+    hi = dash == std::string::npos
+        ? lo : static_cast<unsigned>(std::stoul(arg.substr(dash + 1)));
+}
+
+}
+
+
+int main(int argc, char** argv)
+{
+    HRML::GeneratorOptions options;
+    std::string output;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+                throw std::invalid_argument(arg);
+            std::string value = argv[++i];
+            if (arg == "--seed")
+                options.seed = std::stoull(value);
+            else if (arg == "--nodes")
+                options.nodes = std::stoull(value);
+            else if (arg == "--depth")
+                options.depth = static_cast<unsigned>(std::stoul(value));
+            else if (arg == "--fanout")
+                options.fanout = std::stod(value);
+            else if (arg == "--fanout-distribution" && value == "fixed")
+                options.fanout_distribution = HRML::GeneratorOptions::fixed;
+            else if (arg == "--fanout-distribution" && value == "uniform")
+                options.fanout_distribution = HRML::GeneratorOptions::uniform;
+            else if (arg == "--fanout-distribution" && value == "geometric")
+                options.fanout_distribution =
+                    HRML::GeneratorOptions::geometric;
+            else if (arg == "--tags")
+                options.tags = static_cast<unsigned>(std::stoul(value));
+            else if (arg == "--names")
+                options.names = static_cast<unsigned>(std::stoul(value));
+            else if (arg == "--attributes")
+                range(value, options.min_attributes, options.max_attributes);
+            else if (arg == "--value-length")
+                range(value, options.min_value_length,
+                      options.max_value_length);
+            else if (arg == "--queries")
+                options.queries = std::stoull(value);
+            else if (arg == "--hit-ratio")
+                options.hit_ratio = std::stod(value);
+            else if (arg == "--query-depth")
+                options.query_depth = static_cast<unsigned>(std::stoul(value));
+            else if (arg == "--distinct")
+                options.distinct_queries = std::stoull(value);
+            else if (arg == "--skew")
+                options.skew = std::stod(value);
+            else if (arg == "--output")
+                output = value;
+            else
+                throw std::invalid_argument(arg);
+        }
+    } catch (const std::exception&) {
+        usage();
+        return 2;
+    }
+
+    try {
+        std::ios::sync_with_stdio(false);
+        if (output.empty()) {
+            HRML::generate(options, std::cout);
+        } else {
+            std::ofstream out{output, std::ios::binary | std::ios::trunc};
+            if (!out)
+                throw std::runtime_error("can not write " + output);
+            HRML::generate(options, out);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "hrml_generate: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
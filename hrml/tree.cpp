@@ -0,0 +1,896 @@
+#include "tree.h"
+
+#include <algorithm>
+
+namespace HRML {
+
+std::string_view
+NodeRef::tag(void) const
+{
+    return tree_->symbols().name(tree_->element(index_).tag);
+}
+
+
+std::string
+NodeRef::attribute(const std::string& key) const
+{
+    Symbol symbol = tree_->symbols().find(key);
+    if (symbol == no_symbol)
+        return "";
+    auto value = tree_->attribute(index_, symbol);
+    return value != nullptr ? std::string(*value) : "";
+}
+
+
+NodeRef
+NodeRef::parent(void) const
+{
+    return NodeRef(tree_, tree_->element(index_).parent);
+}
+
+
+NodeRef
+NodeRef::first_child(void) const
+{
+    return NodeRef(tree_, tree_->element(index_).first_child);
+}
+
+
+NodeRef
+NodeRef::next_sibling(void) const
+{
+    return NodeRef(tree_, tree_->element(index_).next_sibling);
+}
+
+
+NodeRef
+NodeRef::child(std::string_view childtag) const
+{
+    Symbol symbol = tree_->symbols().find(childtag);
+    return symbol != no_symbol ? tree_->child(index_, symbol) : NodeRef();
+}
+
+
+NodeRef
+NodeRef::child(Symbol childtag) const
+{
+    return tree_->child(index_, childtag);
+}
+
+
+Tree::Tree(void)
+    : child_indexes_built_{false}, path_index_{false}, path_count_{0},
+      tag_index_ready_{false}
+{
+
+}
+
+
+Tree::~Tree(void)
+{
+
+}
+
+
+NodeIndex
+Tree::link(NodeIndex parent, Symbol tag)
+{
+    auto index = static_cast<NodeIndex>(elements_.size());
+    auto offset = static_cast<std::uint32_t>(attribute_keys_.size());
+    elements_.push_back({tag, no_table, offset, 0, 0,
+                         parent, no_node, no_node, no_node, no_node, false});
+    if (!pending_.empty()) {
+        sources_.emplace_back();
+        pending_.emplace_back(false);
+    }
+
+    if (path_index_)
+        index_path(index);
+
+    if (parent == no_node) {
+        if (!roots_.empty()) {
+            elements_[index].prev_sibling = roots_.back();
+            elements_[roots_.back()].next_sibling = index;
+        }
+        roots_.push_back(index);
+        if (root_by_tag_.size() <= tag)
+            root_by_tag_.resize(tag + 1, no_node);
+        if (root_by_tag_[tag] == no_node)
+            root_by_tag_[tag] = index;
+    } else {
+        Element& up = elements_[parent];
+        elements_[index].prev_sibling = up.last_child;
+        if (up.last_child == no_node)
+            up.first_child = index;
+        else
+            elements_[up.last_child].next_sibling = index;
+        up.last_child = index;
+
+        if (child_indexes_built_)
+            index_child(parent, index);
+    }
+
+    if (tag_index_ready_.load(std::memory_order_relaxed))
+        tag_index_->insert(index);
+    return index;
+}
+
+
+NodeIndex
+Tree::add(NodeIndex parent, Symbol tag,
+          const std::vector<TokenAttribute>& attributes)
+{
+    NodeIndex index = link(parent, tag);
+
+    for (const auto& attr : attributes) {
+        attribute_keys_.push_back(attr.name_escaped
+                                  ? symbols_.intern(attr.name_str())
+                                  : symbols_.intern(attr.name));
+        attribute_values_.push_back(strings_.add(
+                attr.value_escaped ? std::string_view(attr.value_str())
+                                   : attr.value));
+    }
+    elements_[index].attribute_count =
+        static_cast<std::uint32_t>(attributes.size());
+    settle_attributes(elements_[index]);
+    return index;
+}
+
+
+NodeIndex
+Tree::add_lazy(NodeIndex parent, Symbol tag, std::string_view source,
+               const std::vector<TokenAttribute>& attributes)
+{
+    NodeIndex index = link(parent, tag);
+
+    for (const auto& attr : attributes)
+        attribute_keys_.push_back(attr.name_escaped
+                                  ? symbols_.intern(attr.name_str())
+                                  : symbols_.intern(attr.name));
+    attribute_values_.resize(attribute_keys_.size());
+    elements_[index].attribute_count =
+        static_cast<std::uint32_t>(attributes.size());
+    settle_attributes(elements_[index]);
+    if (!attributes.empty())
+        defer(index, {source.data(),
+                      static_cast<std::uint32_t>(source.size())});
+    return index;
+}
+
+
+NodeIndex
+Tree::add_mapped(NodeIndex parent, Symbol tag,
+                 const MappedAttribute* attributes, std::uint32_t count)
+{
+    NodeIndex index = link(parent, tag);
+    for (std::uint32_t i = 0; i < count; i++) {
+        attribute_keys_.push_back(attributes[i].key);
+        attribute_values_.push_back(mapped_pool_.substr(
+                attributes[i].value_offset, attributes[i].value_size));
+    }
+    elements_[index].attribute_count = count;
+    settle_attributes(elements_[index]);
+    return index;
+}
+
+
+void
+Tree::defer(NodeIndex node, LazySource source)
+{
+    if (pending_.size() <= node) {
+        // First deferred node, earlier ones are all materialized
+        sources_.resize(elements_.size());
+        while (pending_.size() < elements_.size())
+            pending_.emplace_back(false);
+    }
+    sources_[node] = source;
+    pending_[node].store(true, std::memory_order_relaxed);
+}
+
+
+void
+Tree::reserve(std::size_t nodes)
+{
+    elements_.reserve(nodes);
+    if (path_index_)
+        node_paths_.reserve(nodes);
+}
+
+
+void
+Tree::materialize(NodeIndex node) const
+{
+    std::lock_guard<std::mutex> lock{materialize_mutex_};
+    if (!pending_[node].load(std::memory_order_relaxed))
+        return;
+
+    // The line tokenized fine once, add_lazy() laid out the names
+    const Element& element = elements_[node];
+    const LazySource& source = sources_[node];
+    Token token;
+    tokenize(std::string_view(source.data, source.size), token);
+    for (const auto& attr : token.attributes) {
+        Symbol key = attr.name_escaped ? symbols_.find(attr.name_str())
+                                       : symbols_.find(attr.name);
+        attribute_values_[find_attribute(element, key)] = attr.value_escaped
+            ? strings_.add(attr.value_str()) : attr.value;
+    }
+    sources_[node] = LazySource();
+    pending_[node].store(false, std::memory_order_release);
+}
+
+
+/*
+ * element's attributes were just appended to the attribute vectors, in
+ * document order: drop repeated names, keeping the first place and the
+ * last value, and sort a span too long to scan.
+ */
+void
+Tree::settle_attributes(Element& element)
+{
+    Symbol* keys = attribute_keys_.data() + element.attributes;
+    std::string_view* values = attribute_values_.data() + element.attributes;
+    std::uint32_t count = element.attribute_count;
+    std::uint32_t kept = 0;
+
+    if (count <= attribute_sort_threshold) {
+        for (std::uint32_t i = 0; i < count; i++) {
+            std::uint32_t j = 0;
+            while (j < kept && keys[j] != keys[i])
+                ++j;
+            if (j == kept)
+                keys[kept++] = keys[i];
+            values[j] = values[i];
+        }
+    } else {
+        // Sorting (name, position) pairs keeps equal names in order
+        std::vector<std::uint64_t> order(count);
+        for (std::uint32_t i = 0; i < count; i++)
+            order[i] = std::uint64_t{keys[i]} << 32 | i;
+        std::sort(order.begin(), order.end());
+        std::vector<std::string_view> sorted;
+        sorted.reserve(count);
+        for (std::uint32_t i = 0; i < count; i++) {
+            auto key = static_cast<Symbol>(order[i] >> 32);
+            if (i + 1 < count && order[i + 1] >> 32 == key)
+                continue;
+            keys[kept++] = key;
+            sorted.push_back(values[order[i] & UINT32_MAX]);
+        }
+        std::copy(sorted.begin(), sorted.end(), values);
+    }
+
+    element.attribute_count = element.attribute_capacity = kept;
+    attribute_keys_.resize(element.attributes + kept);
+    attribute_values_.resize(element.attributes + kept);
+}
+
+
+/* Move element's attributes to the end of the vectors, with more room */
+void
+Tree::move_attributes(Element& element, std::uint32_t capacity)
+{
+    auto offset = static_cast<std::uint32_t>(attribute_keys_.size());
+    attribute_keys_.resize(offset + capacity, no_symbol);
+    attribute_values_.resize(offset + capacity);
+    for (std::uint32_t i = 0; i < element.attribute_count; i++) {
+        attribute_keys_[offset + i] = attribute_keys_[element.attributes + i];
+        attribute_values_[offset + i] =
+            attribute_values_[element.attributes + i];
+    }
+    element.attributes = offset;
+    element.attribute_capacity = capacity;
+}
+
+
+std::uint32_t
+Tree::slot_hash(Symbol tag, std::uint32_t bits)
+{
+    // Fibonacci hashing, symbols are small dense integers
+    return static_cast<std::uint32_t>(tag * 2654435769u) >> (32 - bits);
+}
+
+
+void
+Tree::build_child_index(NodeIndex parent, std::size_t fanout)
+{
+    // Size for the distinct tags only, a wide node often repeats one tag
+    std::vector<Symbol> tags;
+    tags.reserve(fanout);
+    for (NodeIndex i = elements_[parent].first_child; i != no_node;
+         i = elements_[i].next_sibling)
+        tags.push_back(elements_[i].tag);
+    std::sort(tags.begin(), tags.end());
+    auto distinct = static_cast<std::size_t>(
+            std::unique(tags.begin(), tags.end()) - tags.begin());
+
+    std::uint32_t bits = 1;
+    while ((std::size_t{1} << bits) < distinct * 2)
+        ++bits;
+
+    // A block of the right size left by another table comes first
+    release_child_table(parent);
+    ChildTable table{static_cast<std::uint32_t>(child_slots_.size()), bits,
+                     static_cast<std::uint32_t>(distinct)};
+    std::uint32_t mask = (1u << bits) - 1;
+    if (free_child_slots_.size() > bits && !free_child_slots_[bits].empty()) {
+        table.offset = free_child_slots_[bits].back();
+        free_child_slots_[bits].pop_back();
+        std::fill_n(child_slots_.begin() + table.offset, mask + 1,
+                    ChildSlot{no_symbol, no_node});
+    } else {
+        child_slots_.resize(child_slots_.size() + (std::size_t{1} << bits),
+                            ChildSlot{no_symbol, no_node});
+    }
+    ChildSlot* slots = &child_slots_[table.offset];
+
+    // First child with a tag wins, as in the scan
+    for (NodeIndex i = elements_[parent].first_child; i != no_node;
+         i = elements_[i].next_sibling) {
+        Symbol tag = elements_[i].tag;
+        std::uint32_t h = slot_hash(tag, bits);
+        while (slots[h].tag != no_symbol && slots[h].tag != tag)
+            h = (h + 1) & mask;
+        if (slots[h].tag == no_symbol)
+            slots[h] = ChildSlot{tag, i};
+    }
+
+    if (free_child_tables_.empty()) {
+        elements_[parent].child_table =
+            static_cast<std::uint32_t>(child_tables_.size());
+        child_tables_.push_back(table);
+    } else {
+        elements_[parent].child_table = free_child_tables_.back();
+        free_child_tables_.pop_back();
+        child_tables_[elements_[parent].child_table] = table;
+    }
+}
+
+
+/* Give node's child table, if any, and its block back for reuse */
+void
+Tree::release_child_table(NodeIndex node)
+{
+    std::uint32_t index = elements_[node].child_table;
+    if (index == no_table)
+        return;
+    const ChildTable& table = child_tables_[index];
+    if (free_child_slots_.size() <= table.bits)
+        free_child_slots_.resize(table.bits + 1);
+    free_child_slots_[table.bits].push_back(table.offset);
+    free_child_tables_.push_back(index);
+    elements_[node].child_table = no_table;
+}
+
+
+void
+Tree::build_child_indexes(void)
+{
+    child_tables_.clear();
+    child_slots_.clear();
+    free_child_slots_.clear();
+    free_child_tables_.clear();
+    child_indexes_built_ = true;
+
+    std::vector<std::uint32_t> fanout(elements_.size(), 0);
+    for (const auto& element : elements_) {
+        if (element.parent != no_node)
+            ++fanout[element.parent];
+    }
+
+    for (NodeIndex i = 0; i < elements_.size(); i++) {
+        elements_[i].child_table = no_table;
+        if (fanout[i] > child_index_threshold)
+            build_child_index(i, fanout[i]);
+    }
+}
+
+
+std::uint64_t
+Tree::path_hash(std::uint64_t parent, Symbol tag)
+{
+    // splitmix64 finalizer over the parent hash and the tag
+    std::uint64_t h = parent ^ ((tag + 1ull) * 0xbf58476d1ce4e5b9ull);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return h != no_path ? h : 1;
+}
+
+
+void
+Tree::index_path(NodeIndex node)
+{
+    const Element& element = elements_[node];
+    std::uint64_t parent = element.parent == no_node
+        ? root_path : node_paths_[element.parent];
+
+    node_paths_.push_back(no_path);
+    // Below a node that is not indexed no lookup can arrive
+    if (parent == no_path)
+        return;
+
+    std::uint64_t hash = path_hash(parent, element.tag);
+    if (insert_path(hash, node))
+        node_paths_.back() = hash;
+}
+
+
+/*
+ * Record node under hash, unless an earlier node has the same path: same
+ * tag under the same (indexed) parent.
+ */
+bool
+Tree::insert_path(std::uint64_t hash, NodeIndex node)
+{
+    if ((path_count_ + 1) * 2 > path_slots_.size())
+        grow_path_slots();
+
+    const Element& element = elements_[node];
+    std::size_t mask = path_slots_.size() - 1;
+    std::size_t h = hash & mask;
+    for (; path_slots_[h].hash != no_path; h = (h + 1) & mask) {
+        const Element& other = elements_[path_slots_[h].node];
+        if (path_slots_[h].hash == hash && other.tag == element.tag &&
+            other.parent == element.parent)
+            return false;
+    }
+    path_slots_[h] = PathSlot{hash, node};
+    ++path_count_;
+    return true;
+}
+
+
+void
+Tree::grow_path_slots(void)
+{
+    std::vector<PathSlot> old;
+    old.swap(path_slots_);
+    path_slots_.assign(std::max<std::size_t>(16, old.size() * 2),
+                       PathSlot{no_path, no_node});
+
+    std::size_t mask = path_slots_.size() - 1;
+    for (const auto& slot : old) {
+        if (slot.hash == no_path)
+            continue;
+        std::size_t h = slot.hash & mask;
+        while (path_slots_[h].hash != no_path)
+            h = (h + 1) & mask;
+        path_slots_[h] = slot;
+    }
+}
+
+
+std::size_t
+Tree::path_index_bytes(void) const
+{
+    return node_paths_.capacity() * sizeof(std::uint64_t) +
+           path_slots_.capacity() * sizeof(PathSlot);
+}
+
+
+std::size_t
+Tree::child_index_bytes(void) const
+{
+    return child_tables_.capacity() * sizeof(ChildTable) +
+           child_slots_.capacity() * sizeof(ChildSlot);
+}
+
+
+/* Next sibling of node with the same tag, no_node when none */
+NodeIndex
+Tree::next_with_tag(NodeIndex node) const
+{
+    Symbol tag = elements_[node].tag;
+    for (NodeIndex i = elements_[node].next_sibling; i != no_node;
+         i = elements_[i].next_sibling)
+        if (elements_[i].tag == tag) return i;
+    return no_node;
+}
+
+
+/* child was just linked as the last child of parent */
+void
+Tree::index_child(NodeIndex parent, NodeIndex child)
+{
+    const Element& up = elements_[parent];
+
+    if (up.child_table == no_table) {
+        // The scan stops once the node turns out to be wide
+        std::size_t fanout = 0;
+        for (NodeIndex i = up.first_child; i != no_node &&
+             fanout <= child_index_threshold; i = elements_[i].next_sibling)
+            ++fanout;
+        if (fanout > child_index_threshold)
+            build_child_index(parent, fanout);
+        return;
+    }
+
+    ChildTable& table = child_tables_[up.child_table];
+    ChildSlot* slots = &child_slots_[table.offset];
+    std::uint32_t mask = (1u << table.bits) - 1;
+    Symbol tag = elements_[child].tag;
+    std::uint32_t h = slot_hash(tag, table.bits);
+    for (; slots[h].tag != no_symbol; h = (h + 1) & mask)
+        if (slots[h].tag == tag) return;
+
+    if ((table.used + 1) * 2 > mask + 1) {
+        // Full enough, rebuild it twice the size (the old block is freed)
+        build_child_index(parent, 2 * (table.used + 1));
+        return;
+    }
+    slots[h] = ChildSlot{tag, child};
+    ++table.used;
+}
+
+
+/* child is about to be unlinked from parent, still in its sibling list */
+void
+Tree::unindex_child(NodeIndex parent, NodeIndex child)
+{
+    Symbol tag = elements_[child].tag;
+
+    if (parent == no_node) {
+        if (root_by_tag_[tag] == child)
+            root_by_tag_[tag] = next_with_tag(child);
+        return;
+    }
+
+    const Element& up = elements_[parent];
+    if (up.child_table == no_table)
+        return;
+
+    ChildTable& table = child_tables_[up.child_table];
+    ChildSlot* slots = &child_slots_[table.offset];
+    std::uint32_t mask = (1u << table.bits) - 1;
+    std::uint32_t h = slot_hash(tag, table.bits);
+    while (slots[h].tag != tag)
+        h = (h + 1) & mask;
+    if (slots[h].node != child)
+        return;
+
+    NodeIndex next = next_with_tag(child);
+    if (next != no_node) {
+        slots[h].node = next;
+        return;
+    }
+
+    // Backward shift delete, later entries of the cluster move up
+    for (std::uint32_t j = (h + 1) & mask; slots[j].tag != no_symbol;
+         j = (j + 1) & mask) {
+        std::uint32_t home = slot_hash(slots[j].tag, table.bits);
+        if (((j - home) & mask) >= ((j - h) & mask)) {
+            slots[h] = slots[j];
+            h = j;
+        }
+    }
+    slots[h] = ChildSlot{no_symbol, no_node};
+    --table.used;
+}
+
+
+void
+Tree::erase_path(std::uint64_t hash, NodeIndex node)
+{
+    std::size_t mask = path_slots_.size() - 1;
+    std::size_t h = hash & mask;
+    while (path_slots_[h].node != node)
+        h = (h + 1) & mask;
+
+    for (std::size_t j = (h + 1) & mask; path_slots_[j].hash != no_path;
+         j = (j + 1) & mask) {
+        std::size_t home = path_slots_[j].hash & mask;
+        if (((j - home) & mask) >= ((j - h) & mask)) {
+            path_slots_[h] = path_slots_[j];
+            h = j;
+        }
+    }
+    path_slots_[h] = PathSlot{no_path, no_node};
+    --path_count_;
+}
+
+
+/*
+ * Index subtree, which has just become what a lookup of its path
+ * reaches, and below it whatever a lookup would reach in turn.
+ */
+void
+Tree::index_paths(NodeIndex subtree)
+{
+    NodeIndex parent = elements_[subtree].parent;
+    std::uint64_t base = parent == no_node ? root_path : node_paths_[parent];
+    if (base == no_path)
+        return;
+
+    std::uint64_t hash = path_hash(base, elements_[subtree].tag);
+    if (!insert_path(hash, subtree))
+        return;
+    node_paths_[subtree] = hash;
+
+    std::vector<NodeIndex> stack{subtree};
+    while (!stack.empty()) {
+        NodeIndex node = stack.back();
+        stack.pop_back();
+        // Children in order, so the first with each tag wins
+        for (NodeIndex i = elements_[node].first_child; i != no_node;
+             i = elements_[i].next_sibling) {
+            hash = path_hash(node_paths_[node], elements_[i].tag);
+            if (insert_path(hash, i)) {
+                node_paths_[i] = hash;
+                stack.push_back(i);
+            }
+        }
+    }
+}
+
+
+void
+Tree::unindex_paths(NodeIndex subtree)
+{
+    if (node_paths_[subtree] == no_path)
+        return;
+
+    std::vector<NodeIndex> stack{subtree};
+    while (!stack.empty()) {
+        NodeIndex node = stack.back();
+        stack.pop_back();
+        erase_path(node_paths_[node], node);
+        node_paths_[node] = no_path;
+        // Only indexed nodes can have indexed children
+        for (NodeIndex i = elements_[node].first_child; i != no_node;
+             i = elements_[i].next_sibling)
+            if (node_paths_[i] != no_path) stack.push_back(i);
+    }
+}
+
+
+void
+Tree::remove(NodeIndex node)
+{
+    Element& element = elements_[node];
+    if (element.removed)
+        return;
+    if (tag_index_ready_.load(std::memory_order_relaxed))
+        tag_index_->erase(node);
+
+    // A lookup reaching node moves on to its next sibling with that tag
+    NodeIndex successor = no_node;
+    if (path_index_ && node_paths_[node] != no_path) {
+        successor = next_with_tag(node);
+        unindex_paths(node);
+    }
+    if (element.parent == no_node || child_indexes_built_)
+        unindex_child(element.parent, node);
+
+    if (element.parent == no_node) {
+        roots_.erase(std::lower_bound(roots_.begin(), roots_.end(), node));
+    } else {
+        Element& up = elements_[element.parent];
+        if (element.prev_sibling == no_node)
+            up.first_child = element.next_sibling;
+        if (element.next_sibling == no_node)
+            up.last_child = element.prev_sibling;
+    }
+    if (element.prev_sibling != no_node)
+        elements_[element.prev_sibling].next_sibling = element.next_sibling;
+    if (element.next_sibling != no_node)
+        elements_[element.next_sibling].prev_sibling = element.prev_sibling;
+
+    if (successor != no_node)
+        index_paths(successor);
+
+    std::vector<NodeIndex> stack{node};
+    while (!stack.empty()) {
+        NodeIndex i = stack.back();
+        stack.pop_back();
+        elements_[i].removed = true;
+        release_child_table(i);
+        for (NodeIndex c = elements_[i].first_child; c != no_node;
+             c = elements_[c].next_sibling)
+            stack.push_back(c);
+    }
+}
+
+
+void
+Tree::set_attribute(NodeIndex node, Symbol key, std::string_view value)
+{
+    materialize_pending(node);
+    Element& element = elements_[node];
+    std::uint32_t at = find_attribute(element, key);
+    if (at != no_attribute) {
+        attribute_values_[at] = strings_.add(value);
+        return;
+    }
+
+    // The span doubles at the end of the vectors, its old place goes unused
+    if (element.attribute_count == element.attribute_capacity)
+        move_attributes(element, std::max(2u, 2 * element.attribute_capacity));
+    at = element.attributes + element.attribute_count++;
+    attribute_keys_[at] = key;
+    attribute_values_[at] = strings_.add(value);
+
+    // Past the threshold the span is sorted, insertion puts the name in place
+    if (element.attribute_count > attribute_sort_threshold) {
+        for (std::uint32_t i = element.attributes + 1; i <= at; i++)
+            for (std::uint32_t j = i; j > element.attributes &&
+                 attribute_keys_[j] < attribute_keys_[j - 1]; j--) {
+                std::swap(attribute_keys_[j], attribute_keys_[j - 1]);
+                std::swap(attribute_values_[j], attribute_values_[j - 1]);
+            }
+    }
+}
+
+
+bool
+Tree::remove_attribute(NodeIndex node, Symbol key)
+{
+    materialize_pending(node);
+    Element& element = elements_[node];
+    std::uint32_t at = find_attribute(element, key);
+    if (at == no_attribute)
+        return false;
+
+    // Shifting keeps a sorted span sorted
+    std::uint32_t end = element.attributes + element.attribute_count;
+    std::move(attribute_keys_.begin() + at + 1,
+              attribute_keys_.begin() + end, attribute_keys_.begin() + at);
+    std::move(attribute_values_.begin() + at + 1,
+              attribute_values_.begin() + end, attribute_values_.begin() + at);
+    --element.attribute_count;
+    return true;
+}
+
+
+void
+Tree::clear(void)
+{
+    elements_.clear();
+    elements_.shrink_to_fit();
+    symbols_.clear();
+    attribute_keys_.clear();
+    attribute_keys_.shrink_to_fit();
+    attribute_values_.clear();
+    attribute_values_.shrink_to_fit();
+    strings_.clear();
+    child_tables_.clear();
+    child_slots_.clear();
+    free_child_slots_.clear();
+    free_child_tables_.clear();
+    roots_.clear();
+    roots_.shrink_to_fit();
+    tag_index_.reset();
+    tag_index_ready_.store(false, std::memory_order_relaxed);
+    root_by_tag_.clear();
+    child_indexes_built_ = false;
+    node_paths_.clear();
+    node_paths_.shrink_to_fit();
+    path_slots_.clear();
+    path_slots_.shrink_to_fit();
+    path_count_ = 0;
+    sources_.clear();
+    sources_.shrink_to_fit();
+    pending_.clear();
+    mapped_pool_ = std::string_view();
+}
+
+
+void
+Tree::swap(Tree& other)
+{
+    using std::swap;
+    swap(symbols_, other.symbols_);
+    swap(elements_, other.elements_);
+    swap(roots_, other.roots_);
+    swap(root_by_tag_, other.root_by_tag_);
+    swap(attribute_keys_, other.attribute_keys_);
+    swap(attribute_values_, other.attribute_values_);
+    swap(strings_, other.strings_);
+    swap(child_tables_, other.child_tables_);
+    swap(child_slots_, other.child_slots_);
+    swap(free_child_slots_, other.free_child_slots_);
+    swap(free_child_tables_, other.free_child_tables_);
+    swap(child_indexes_built_, other.child_indexes_built_);
+    swap(path_index_, other.path_index_);
+    swap(node_paths_, other.node_paths_);
+    swap(path_slots_, other.path_slots_);
+    swap(path_count_, other.path_count_);
+    swap(sources_, other.sources_);
+    swap(pending_, other.pending_);
+    swap(mapped_pool_, other.mapped_pool_);
+
+    // An index refers to its tree
+    for (Tree* tree : {this, &other}) {
+        tree->tag_index_.reset();
+        tree->tag_index_ready_.store(false, std::memory_order_relaxed);
+    }
+}
+
+
+NodeRef
+Tree::root(Symbol tag) const
+{
+    if (tag >= root_by_tag_.size())
+        return NodeRef();
+    return NodeRef(this, root_by_tag_[tag]);
+}
+
+
+NodeRef
+Tree::child(NodeIndex parent, Symbol tag) const
+{
+    const Element& element = elements_[parent];
+
+    if (element.child_table != no_table) {
+        const ChildTable& table = child_tables_[element.child_table];
+        const ChildSlot* slots = &child_slots_[table.offset];
+        std::uint32_t mask = (1u << table.bits) - 1;
+        std::uint32_t h = slot_hash(tag, table.bits);
+        for (;; h = (h + 1) & mask) {
+            if (slots[h].tag == tag)
+                return NodeRef(this, slots[h].node);
+            if (slots[h].tag == no_symbol)
+                return NodeRef();
+        }
+    }
+
+    for (NodeIndex i = element.first_child; i != no_node;
+         i = elements_[i].next_sibling)
+        if (elements_[i].tag == tag) return NodeRef(this, i);
+    return NodeRef();
+}
+
+
+NodeRef
+Tree::child(NodeIndex parent, Symbol tag, std::uint64_t& steps) const
+{
+    const Element& element = elements_[parent];
+
+    if (element.child_table != no_table) {
+        const ChildTable& table = child_tables_[element.child_table];
+        const ChildSlot* slots = &child_slots_[table.offset];
+        std::uint32_t mask = (1u << table.bits) - 1;
+        for (std::uint32_t h = slot_hash(tag, table.bits);;
+             h = (h + 1) & mask) {
+            ++steps;
+            if (slots[h].tag == tag)
+                return NodeRef(this, slots[h].node);
+            if (slots[h].tag == no_symbol)
+                return NodeRef();
+        }
+    }
+
+    for (NodeIndex i = element.first_child; i != no_node;
+         i = elements_[i].next_sibling) {
+        ++steps;
+        if (elements_[i].tag == tag) return NodeRef(this, i);
+    }
+    return NodeRef();
+}
+
+
+Tree::AttributeSpan
+Tree::attributes(NodeIndex node) const
+{
+    materialize_pending(node);
+    const Element& element = elements_[node];
+    return {attribute_keys_.data() + element.attributes,
+            attribute_values_.data() + element.attributes,
+            element.attribute_count};
+}
+
+
+const TagIndex&
+Tree::tag_index(void) const
+{
+    if (!tag_index_ready_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock{tag_index_mutex_};
+        if (!tag_index_ready_.load(std::memory_order_relaxed)) {
+            tag_index_ = std::make_unique<TagIndex>(*this);
+            tag_index_ready_.store(true, std::memory_order_release);
+        }
+    }
+    return *tag_index_;
+}
+
+}
@@ -0,0 +1,368 @@
+#ifndef TREE_HPP_
+#define TREE_HPP_
+
+#include "string_arena.h"
+#include "symbols.h"
+#include "tag_index.h"
+#include "tokenizer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace HRML {
+
+using NodeIndex = std::uint32_t;
+inline constexpr NodeIndex no_node = UINT32_MAX;
+
+class Tree;
+
+
+/*
+ * Attribute of a node added by Tree::add_mapped(). The value is
+ * value_size bytes at value_offset in the pool given to map_strings().
+ */
+struct MappedAttribute {
+    Symbol key;
+    std::uint32_t value_offset;
+    std::uint32_t value_size;
+};
+
+
+/*
+ * Handle to a node stored in a Tree. It is a (tree, index) pair, cheap to
+ * copy, and stays usable for as long as the tree it points to. A default
+ * constructed handle refers to no node and converts to false.
+ */
+class NodeRef {
+    public:
+        NodeRef(void) : tree_{nullptr}, index_{no_node} {}
+        NodeRef(const Tree* tree, NodeIndex index)
+            : tree_{index != no_node ? tree : nullptr}, index_{index} {}
+
+        explicit operator bool(void) const { return tree_ != nullptr; }
+        NodeIndex index(void) const { return index_; }
+
+        std::string_view tag(void) const;
+        std::string attribute(const std::string& key) const;
+
+        NodeRef parent(void) const;
+        NodeRef first_child(void) const;
+        NodeRef next_sibling(void) const;
+        NodeRef child(std::string_view childtag) const;
+        NodeRef child(Symbol childtag) const;
+
+    private:
+        const Tree* tree_;
+        NodeIndex index_;
+};
+
+
+/*
+ * Document tree kept in one contiguous arena. Nodes refer to each other
+ * by 32-bit index (parent, first and last child, siblings both ways).
+ * Top level nodes are linked as siblings too and listed in document
+ * order in a vector of their own, next to a table giving the first root
+ * for each tag symbol. Nodes are never freed one by one, the whole arena
+ * goes at once.
+ *
+ * Tags and attribute names are interned in the tree's SymbolTable, so all
+ * lookups by Symbol compare integers. Lookups by name resolve the name
+ * first and fail fast when the document never used it.
+ *
+ * Attributes are kept out of line: each node owns a span of the tree's
+ * key and value vectors. Up to attribute_sort_threshold of them stay in
+ * document order and are scanned, more are sorted by name and bisected.
+ * A name given twice keeps its last value. Like a FlatMap, this takes
+ * no allocation per node, and unlike one it costs an Element nothing
+ * for room left unused: four inline pairs would more than double it.
+ *
+ * Nodes with more than child_index_threshold children get an open
+ * addressing table from child tag to first child with that tag, built by
+ * build_child_indexes() once the document is complete. Narrower nodes are
+ * scanned.
+ *
+ * With the path index on, add() also hashes each node's tag path
+ * (root tag first) and records the node a child-by-child lookup of that
+ * path would reach: the first root with the tag, then the first child
+ * with each following tag. Any other node is left out, so a query path
+ * resolves with one probe. Paths are hashed to 64 bits and distinct
+ * paths may collide, so lookups get a check on the node's ancestry.
+ *
+ * Attribute values are views. add() and set_attribute() copy the text
+ * into the tree's StringArena, which never moves it. Nodes added by
+ * add_lazy() only keep a view of their source line. Their names are laid
+ * out right away, but the line is tokenized again for the values the
+ * first time attribute() looks at them, which is safe from concurrent
+ * readers. Values then point into the line, or into the arena when they
+ * had escapes to drop. Nodes added by add_mapped() point into a mapped
+ * snapshot. Lazy and mapped sources have to outlive the tree.
+ *
+ * Once build_child_indexes() has run, adding and removing nodes keeps
+ * the roots, the child tables and the path index up to date in place.
+ * A child table that grows moves to a block twice the size; blocks left
+ * behind, and those of removed nodes, are kept by size for reuse.
+ * Removed nodes stay in the arena, unreachable. Text a value
+ * viewed stays in place when the value is replaced or removed, so views
+ * handed out earlier stay valid until clear().
+ *
+ * tag_index() labels the nodes and lists them by tag for pattern
+ * queries. It is built on first use, so exact lookups never pay for it,
+ * and from then on adding and removing nodes updates it in place.
+ */
+class Tree {
+    public:
+        static constexpr std::size_t child_index_threshold = 32;
+        static constexpr std::uint32_t attribute_sort_threshold = 16;
+        static constexpr std::uint32_t no_table = UINT32_MAX;
+        static constexpr std::uint64_t no_path = 0;
+        /* Hash of the empty path, the parent of the roots */
+        static constexpr std::uint64_t root_path = 0x9e3779b97f4a7c15ull;
+
+        struct Element {
+            Symbol tag;
+            std::uint32_t child_table;
+            /* Span [attributes, + attribute_count) of the attribute vectors */
+            std::uint32_t attributes;
+            std::uint32_t attribute_count;
+            std::uint32_t attribute_capacity;
+            NodeIndex parent;
+            NodeIndex first_child;
+            NodeIndex last_child;
+            NodeIndex next_sibling;
+            NodeIndex prev_sibling;
+            bool removed;
+        };
+
+        /* Attributes of one node, names and values side by side */
+        struct AttributeSpan {
+            const Symbol* keys;
+            const std::string_view* values;
+            std::uint32_t size;
+        };
+
+        Tree(void);
+        ~Tree(void);
+
+        /* Append a node as the last child of parent (no_node: a root) */
+        NodeIndex add(NodeIndex parent, Symbol tag,
+                      const std::vector<TokenAttribute>& attributes);
+        /*
+         * Same, but attribute values stay in source (the line attributes
+         * were tokenized from). Names are interned right away so queries
+         * can be compiled against them.
+         */
+        NodeIndex add_lazy(NodeIndex parent, Symbol tag, std::string_view source,
+                           const std::vector<TokenAttribute>& attributes);
+        /*
+         * Same, for attributes laid out by a snapshot: count entries at
+         * attributes, names interned already, values in the pool set by
+         * map_strings(). The pool has to outlive the tree.
+         */
+        NodeIndex add_mapped(NodeIndex parent, Symbol tag,
+                             const MappedAttribute* attributes,
+                             std::uint32_t count);
+        void map_strings(std::string_view pool) { mapped_pool_ = pool; }
+        /* Room for this many nodes in all, no reallocation before that */
+        void reserve(std::size_t nodes);
+        void build_child_indexes(void);
+        void clear(void);
+        /*
+         * Exchange contents with other, neither having readers at the
+         * time. Tag indexes are dropped, to be built again on use.
+         */
+        void swap(Tree& other);
+
+        /*
+         * Unlink node and its subtree, handles to them become invalid.
+         * Walks node's later siblings when it is the first with its tag
+         * under an indexed parent or among the roots.
+         */
+        void remove(NodeIndex node);
+        void set_attribute(NodeIndex node, Symbol key, std::string_view value);
+        /* false when the node had no such attribute */
+        bool remove_attribute(NodeIndex node, Symbol key);
+
+        /* Only affects nodes added afterwards, set it on an empty tree */
+        void set_path_index(bool enabled) { path_index_ = enabled; }
+        bool path_index(void) const { return path_index_; }
+        /* Heap bytes held by the path index */
+        std::size_t path_index_bytes(void) const;
+        static std::uint64_t path_hash(std::uint64_t parent, Symbol tag);
+        /* Heap bytes held by the child tables */
+        std::size_t child_index_bytes(void) const;
+
+        SymbolTable& symbols(void) { return symbols_; }
+        const SymbolTable& symbols(void) const { return symbols_; }
+
+        std::size_t size(void) const { return elements_.size(); }
+        const Element& element(NodeIndex i) const { return elements_[i]; }
+
+        /* Roots in document order */
+        const std::vector<NodeIndex>& roots(void) const { return roots_; }
+        NodeIndex first_root(void) const
+        {
+            return roots_.empty() ? no_node : roots_.front();
+        }
+        NodeRef root(Symbol tag) const;
+        NodeRef child(NodeIndex parent, Symbol tag) const;
+        /* Same, adding the slots probed or children looked at to steps */
+        NodeRef child(NodeIndex parent, Symbol tag, std::uint64_t& steps) const;
+        /* nullptr when the node has no such attribute */
+        const std::string_view* attribute(NodeIndex node, Symbol key) const
+        {
+            materialize_pending(node);
+            std::uint32_t at = find_attribute(elements_[node], key);
+            return at != no_attribute ? &attribute_values_[at] : nullptr;
+        }
+        AttributeSpan attributes(NodeIndex node) const;
+        /* Safe from concurrent readers */
+        const TagIndex& tag_index(void) const;
+
+        /*
+         * Indexed node whose path hashes to hash and for which
+         * on_path(index) holds, on_path telling colliding paths apart.
+         */
+        template <class Check>
+        NodeRef path(std::uint64_t hash, Check on_path) const
+        {
+            if (path_slots_.empty())
+                return NodeRef();
+            std::size_t mask = path_slots_.size() - 1;
+            for (std::size_t h = hash & mask; path_slots_[h].hash != no_path;
+                 h = (h + 1) & mask) {
+                if (path_slots_[h].hash == hash && on_path(path_slots_[h].node))
+                    return NodeRef(this, path_slots_[h].node);
+            }
+            return NodeRef();
+        }
+
+    private:
+        struct ChildSlot {
+            Symbol tag;
+            NodeIndex node;
+        };
+
+        /* child_slots_[offset, offset + 2^bits), `used` of them taken */
+        struct ChildTable {
+            std::uint32_t offset;
+            std::uint32_t bits;
+            std::uint32_t used;
+        };
+
+        struct PathSlot {
+            std::uint64_t hash;
+            NodeIndex node;
+        };
+
+        /* Source line of a lazy node */
+        struct LazySource {
+            const char* data = nullptr;
+            std::uint32_t size = 0;
+        };
+
+        static constexpr std::uint32_t no_attribute = UINT32_MAX;
+
+        NodeIndex link(NodeIndex parent, Symbol tag);
+        void settle_attributes(Element& element);
+        void move_attributes(Element& element, std::uint32_t capacity);
+        void defer(NodeIndex node, LazySource source);
+        void materialize(NodeIndex node) const;
+
+        void materialize_pending(NodeIndex node) const
+        {
+            if (!pending_.empty() &&
+                pending_[node].load(std::memory_order_acquire))
+                materialize(node);
+        }
+
+        /* Position of key in the attribute vectors, no_attribute if absent */
+        std::uint32_t find_attribute(const Element& element, Symbol key) const
+        {
+            const Symbol* keys = attribute_keys_.data() + element.attributes;
+            std::uint32_t count = element.attribute_count;
+            if (count <= attribute_sort_threshold) {
+                // No early exit, the trip count is the same for every key
+                std::uint32_t at = no_attribute;
+                for (std::uint32_t i = 0; i < count; i++)
+                    at = keys[i] == key ? element.attributes + i : at;
+                return at;
+            }
+
+            // Branch-free bisection, the compare only picks the half
+            const Symbol* base = keys;
+            for (std::uint32_t n = count; n > 1;) {
+                std::uint32_t half = n / 2;
+                base = base[half] < key ? base + half : base;
+                n -= half;
+            }
+            base += *base < key;
+            return base != keys + count && *base == key
+                ? element.attributes + static_cast<std::uint32_t>(base - keys)
+                : no_attribute;
+        }
+        NodeIndex next_with_tag(NodeIndex node) const;
+        void index_child(NodeIndex parent, NodeIndex child);
+        void unindex_child(NodeIndex parent, NodeIndex child);
+        static std::uint32_t slot_hash(Symbol tag, std::uint32_t bits);
+        void build_child_index(NodeIndex parent, std::size_t fanout);
+        void release_child_table(NodeIndex node);
+        void index_path(NodeIndex node);
+        bool insert_path(std::uint64_t hash, NodeIndex node);
+        void erase_path(std::uint64_t hash, NodeIndex node);
+        void grow_path_slots(void);
+        void index_paths(NodeIndex subtree);
+        void unindex_paths(NodeIndex subtree);
+
+        SymbolTable symbols_;
+        std::vector<Element> elements_;
+        /* Sorted by index too, as roots are only ever appended */
+        std::vector<NodeIndex> roots_;
+        /* First root for each tag, indexed by Symbol */
+        std::vector<NodeIndex> root_by_tag_;
+
+        std::vector<Symbol> attribute_keys_;
+        /* Values of lazy nodes are filled in by materialize() */
+        mutable std::vector<std::string_view> attribute_values_;
+        /* Copied value text, materialize() adds values it unescaped */
+        mutable StringArena strings_;
+
+        std::vector<ChildTable> child_tables_;
+        std::vector<ChildSlot> child_slots_;
+        /* Offsets of unused blocks in child_slots_, indexed by bits */
+        std::vector<std::vector<std::uint32_t>> free_child_slots_;
+        /* Entries of child_tables_ no node uses */
+        std::vector<std::uint32_t> free_child_tables_;
+        /* Set by build_child_indexes(), then link() maintains them */
+        bool child_indexes_built_;
+
+        bool path_index_;
+        /* Path hash of each node, no_path when it is not indexed */
+        std::vector<std::uint64_t> node_paths_;
+        /* Open addressing, power of two size, at most half full */
+        std::vector<PathSlot> path_slots_;
+        std::size_t path_count_;
+
+        /*
+         * Source line of each node still to materialize (empty once done
+         * or for eager nodes), guarded by materialize_mutex_ and published
+         * through the node's flag.
+         */
+        mutable std::vector<LazySource> sources_;
+        mutable std::deque<std::atomic<bool>> pending_;
+        mutable std::mutex materialize_mutex_;
+        std::string_view mapped_pool_;
+
+        /* Set once built, then link() and remove() keep it current */
+        mutable std::unique_ptr<TagIndex> tag_index_;
+        mutable std::atomic<bool> tag_index_ready_;
+        mutable std::mutex tag_index_mutex_;
+};
+
+}
+#endif